@@ -0,0 +1,194 @@
+// CPSC 3500: Block allocator
+// Hands out free blocks from allocation groups, each an equal slice of the
+// free bitmap with its own lock. A thread allocates from the group of the
+// CPU it runs on and steals from the other groups only when that one is
+// full, so sessions on different CPUs never wait for each other and each
+// one's blocks stay close together. The bitmap written to disk only ever
+// holds committed allocations and reclaims: each thread's changes are
+// applied to it when its operation commits, and a reclaimed block can be
+// allocated again only after that. A data block files share after a copy
+// counts its extra references, and releasing it drops one of them until
+// the last one frees it.
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <sched.h>
+using namespace std;
+
+#include "Allocator.h"
+#include "Trace.h"
+
+// Blocks the calling thread allocated and released since its last commit
+static thread_local vector<short> allocated;
+static thread_local vector<short> released;
+
+// Shared blocks the calling thread's commit drops a reference to
+static thread_local vector<short> unshared;
+
+// Loads the free bitmap from super, or with NULL for a corrupt
+// superblock hands out no blocks at all
+void Allocator::mount(const superblock_t *super)
+{
+  usable = super != NULL;
+  if (usable)
+    committed = *super;
+  else
+    memset(committed.bitmap, 0xFF, BLOCK_SIZE);
+
+  for (int g = 0; g < ALLOC_GROUPS; g++) {
+    memcpy(groups[g].bitmap, committed.bitmap + g * sizeof(groups[g].bitmap),
+           sizeof(groups[g].bitmap));
+    int free_blocks = 0;
+    for (int b = 0; b < ALLOC_GROUP_BLOCKS; b++)
+      free_blocks += !(groups[g].bitmap[b / 8] & (1 << (b % 8)));
+    groups[g].free_blocks = free_blocks;
+  }
+  for (int b = 0; b < NUM_BLOCKS; b++)
+    shares[b] = 0;
+}
+
+// Takes a free block for the calling thread's operation. Returns 0 if
+// the disk is full.
+short Allocator::allocate()
+{
+  // start with the group of this CPU, then steal from the next ones
+  int cpu = sched_getcpu();
+  int home = cpu < 0 ? 0 : cpu % ALLOC_GROUPS;
+  for (int i = 0; i < ALLOC_GROUPS; i++) {
+    int g = (home + i) % ALLOC_GROUPS;
+    if (groups[g].free_blocks.load(memory_order_relaxed) == 0)
+      continue;
+    short block_num = allocate_from(g);
+    if (block_num != 0) {
+      if (i > 0) {
+        TraceScope trace("alloc_steal", g);
+      }
+      allocated.push_back(block_num);
+      return block_num;
+    }
+  }
+
+  // disk is full
+  return 0;
+}
+
+// Takes a free block from group g, returns 0 if it has none
+short Allocator::allocate_from(int g)
+{
+  AllocGroup& group = groups[g];
+  lock_guard<mutex> guard(group.lock);
+  for (int byte = 0; byte < (int) sizeof(group.bitmap); byte++) {
+
+    // check to see if byte has available slot
+    if (group.bitmap[byte] != 0xFF) {
+      for (int bit = 0; bit < 8; bit++) {
+        int mask = 1 << bit;
+        if (mask & ~group.bitmap[byte]) {
+          group.bitmap[byte] |= mask;
+          group.free_blocks--;
+          return g * ALLOC_GROUP_BLOCKS + byte * 8 + bit;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// Gives block_num back once the calling thread's operation commits
+void Allocator::release(short block_num)
+{
+  // with a corrupt superblock the block leaks
+  if (usable)
+    released.push_back(block_num);
+}
+
+// Gives the n blocks in block_nums back once the calling thread's
+// operation commits
+void Allocator::release(const short *block_nums, int n)
+{
+  if (usable)
+    released.insert(released.end(), block_nums, block_nums + n);
+}
+
+// Adds a reference to block_num, a data block in use, so it takes one
+// more release to free it
+void Allocator::share(short block_num)
+{
+  shares[block_num]++;
+}
+
+// true if block_num has more than one reference, so it must be copied
+// before it is written
+bool Allocator::shared(short block_num)
+{
+  // releases count only once committed, so this errs toward copying
+  return shares[block_num] > 0;
+}
+
+// true if the calling thread allocated or released blocks since its
+// last commit
+bool Allocator::pending()
+{
+  return !allocated.empty() || !released.empty();
+}
+
+// Applies the calling thread's allocations and releases to the
+// committed bitmap and copies it into super, to be written as block 0
+// of the operation. A release of a shared block only drops a reference.
+// One thread at a time, until finish_commit().
+void Allocator::prepare_commit(superblock_t *super)
+{
+  // allocations first, a block allocated and released again by the same
+  // operation ends up free
+  for (size_t i = 0; i < allocated.size(); i++)
+    committed.bitmap[allocated[i] / 8] |= 1 << (allocated[i] % 8);
+
+  // a shared block is freed by the release that finds no references
+  // left, counting the ones this operation drops itself
+  sort(released.begin(), released.end());
+  size_t freed = 0;
+  unsigned int drops = 0;	// references to released[i] dropped before it
+  for (size_t i = 0; i < released.size(); i++) {
+    short b = released[i];
+    drops = (i > 0 && released[i - 1] == b) ? drops + 1 : 0;
+    if (drops < shares[b]) {
+      unshared.push_back(b);
+      continue;
+    }
+    committed.bitmap[b / 8] &= ~(1 << (b % 8));
+    released[freed++] = b;
+  }
+  released.resize(freed);
+  allocated.clear();
+  *super = committed;
+}
+
+// Makes the blocks the calling thread released free again and drops
+// its references to shared ones, call once the bitmap from
+// prepare_commit() is committed
+void Allocator::finish_commit()
+{
+  // references go once committed, so a block is written in place only
+  // after the release that left it unshared
+  for (size_t i = 0; i < unshared.size(); i++)
+    shares[unshared[i]]--;
+  unshared.clear();
+
+  // in block order, so each group is locked once however many of its
+  // blocks were released
+  size_t i = 0;
+  while (i < released.size()) {
+    int g = released[i] / ALLOC_GROUP_BLOCKS;
+    AllocGroup& group = groups[g];
+    lock_guard<mutex> guard(group.lock);
+    for (; i < released.size() && released[i] / ALLOC_GROUP_BLOCKS == g; i++) {
+      int b = released[i] % ALLOC_GROUP_BLOCKS;
+      if (group.bitmap[b / 8] & (1 << (b % 8))) {
+        group.bitmap[b / 8] &= ~(1 << (b % 8));
+        group.free_blocks++;
+      }
+    }
+  }
+  released.clear();
+}
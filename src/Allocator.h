@@ -0,0 +1,84 @@
+// CPSC 3500: Block allocator
+// Hands out free blocks from allocation groups, each an equal slice of the
+// free bitmap with its own lock. A thread allocates from the group of the
+// CPU it runs on and steals from the other groups only when that one is
+// full, so sessions on different CPUs never wait for each other and each
+// one's blocks stay close together. The bitmap written to disk only ever
+// holds committed allocations and reclaims: each thread's changes are
+// applied to it when its operation commits, and a reclaimed block can be
+// allocated again only after that. A data block files share after a copy
+// counts its extra references, and releasing it drops one of them until
+// the last one frees it.
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <mutex>
+#include <atomic>
+
+#include "Blocks.h"
+
+// Number of allocation groups and the blocks in each
+const static int ALLOC_GROUPS = 8;
+const static int ALLOC_GROUP_BLOCKS = NUM_BLOCKS / ALLOC_GROUPS;
+
+class Allocator {
+
+  public:
+    // Loads the free bitmap from super, or with NULL for a corrupt
+    // superblock hands out no blocks at all
+    void mount(const superblock_t *super);
+
+    // Takes a free block for the calling thread's operation. Returns 0 if
+    // the disk is full.
+    short allocate();
+
+    // Gives block_num back once the calling thread's operation commits
+    void release(short block_num);
+
+    // Gives the n blocks in block_nums back once the calling thread's
+    // operation commits
+    void release(const short *block_nums, int n);
+
+    // Adds a reference to block_num, a data block in use, so it takes one
+    // more release to free it
+    void share(short block_num);
+
+    // true if block_num has more than one reference, so it must be copied
+    // before it is written
+    bool shared(short block_num);
+
+    // true if the calling thread allocated or released blocks since its
+    // last commit
+    bool pending();
+
+    // Applies the calling thread's allocations and releases to the
+    // committed bitmap and copies it into super, to be written as block 0
+    // of the operation. A release of a shared block only drops a reference.
+    // One thread at a time, until finish_commit().
+    void prepare_commit(superblock_t *super);
+
+    // Makes the blocks the calling thread released free again and drops
+    // its references to shared ones, call once the bitmap from
+    // prepare_commit() is committed
+    void finish_commit();
+
+  private:
+    // One slice of the bitmap, on its own cache line so groups used from
+    // different CPUs do not share one
+    struct alignas(64) AllocGroup {
+      std::mutex lock;
+      std::atomic<int> free_blocks;	// read without the lock to skip full groups
+      unsigned char bitmap[ALLOC_GROUP_BLOCKS / 8];
+    };
+
+    AllocGroup groups[ALLOC_GROUPS];	// blocks handed out, committed or not
+    superblock_t committed;	// bitmap as of the last committed operation
+    std::atomic<unsigned short> shares[NUM_BLOCKS];	// references to each block beyond the first
+    bool usable = false;	// false if the superblock was corrupt
+
+    // Takes a free block from group g, returns 0 if it has none
+    short allocate_from(int g);
+};
+
+#endif
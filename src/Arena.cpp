@@ -0,0 +1,46 @@
+// CPSC 3500: Arena
+// Scratch memory for the requests of one connection. Allocating bumps a
+// pointer through chunks the arena keeps for the whole connection, and
+// everything a request allocated is freed at once when it ends, so a
+// connection stops calling the heap once its chunks are big enough.
+
+using namespace std;
+
+#include "Arena.h"
+
+// alignment of every allocation, enough for any type
+static const size_t ARENA_ALIGN = alignof(max_align_t);
+
+Arena::Arena(size_t chunk_size) : chunk_size(chunk_size) {
+  Chunk first = {new char[chunk_size], chunk_size};
+  chunks.push_back(first);
+}
+
+Arena::~Arena() {
+  for(size_t i = 0; i < chunks.size(); i++)
+    delete [] chunks[i].data;
+}
+
+// Returns n bytes aligned for any type, valid until reset()
+void* Arena::alloc(size_t n) {
+  used = (used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  //Move on to the next chunk that fits, adding one only if none does
+  while(used + n > chunks[current].size) {
+    used = 0;
+    if(++current == chunks.size()) {
+      size_t size = n > chunk_size ? n : chunk_size;
+      Chunk next = {new char[size], size};
+      chunks.push_back(next);
+    }
+  }
+  void* p = chunks[current].data + used;
+  used += n;
+  return p;
+}
+
+// Frees everything allocated since the last reset, keeping the chunks
+void Arena::reset() {
+  current = 0;
+  used = 0;
+}
@@ -0,0 +1,50 @@
+// CPSC 3500: Arena
+// Scratch memory for the requests of one connection. Allocating bumps a
+// pointer through chunks the arena keeps for the whole connection, and
+// everything a request allocated is freed at once when it ends, so a
+// connection stops calling the heap once its chunks are big enough.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// Bytes in a chunk, enough for any request on a full-size file
+const static size_t ARENA_CHUNK = 16384;
+
+class Arena {
+
+  public:
+    explicit Arena(size_t chunk_size = ARENA_CHUNK);
+    ~Arena();
+
+    // Returns n bytes aligned for any type, valid until reset()
+    void* alloc(size_t n);
+
+    // Returns an array of n objects of a type that needs no constructor
+    // or destructor, valid until reset()
+    template <typename T>
+    T* alloc_array(size_t n) {
+      return static_cast<T*>(alloc(n * sizeof(T)));
+    }
+
+    // Frees everything allocated since the last reset, keeping the chunks
+    void reset();
+
+  private:
+    struct Chunk {
+      char* data;
+      size_t size;
+    };
+
+    std::vector<Chunk> chunks;	// every chunk, in the order they are used
+    size_t chunk_size;
+    size_t current = 0;	// chunk allocations come from
+    size_t used = 0;	// bytes used in the current chunk
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+};
+
+#endif
@@ -2,21 +2,108 @@
 // Implements low-level file system functionality that interfaces with
 // the disk.
 
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+using namespace std;
+
 #include "Disk.h"
 #include "Blocks.h"
 #include "BasicFileSys.h"
+#include "Stats.h"
+#include "Trace.h"
+
+// Lets the read-ahead thread go if the process exits still mounted
+BasicFileSys::~BasicFileSys()
+{
+  if (prefetcher.joinable())
+    prefetcher.detach();
+}
 
 // Mounts the simulated disk file. If a disk file is created, this
 // routines also "formats" the disk by initializing special blocks
 // 0 (superblock) and 1 (root directory).
-void BasicFileSys::mount()
+void BasicFileSys::mount(const char *file_name)
+{
+  // mount the disk, a new disk is formatted first
+  if (disk.mount(file_name))
+    format();
+
+  // load the block checksums, computing them for a disk that has none
+  checksums.mount(&disk);
+
+  // replay committed operations a crash kept from reaching their blocks
+  journal.mount(&disk, &checksums);
+
+  // load the free bitmap, no block can be handed out safely if it is corrupt
+  struct superblock_t super_block;
+  if (read_block(0, (void *) &super_block))
+    allocator.mount(&super_block);
+  else
+    allocator.mount(NULL);
+  for (int b = 0; b < NUM_BLOCKS; b++)
+    frozen[b] = false;
+  count_refs();
+
+  prefetching = true;
+  prefetcher = thread(&BasicFileSys::prefetch_loop, this);
+}
+
+// Counts the files referencing each data block and marks the blocks
+// of the snapshots read-only, both are only known from the tree
+void BasicFileSys::count_refs()
 {
-  // mount the disk
-  bool new_disk = disk.mount("DISK");
+  vector<bool> seen(NUM_BLOCKS, false);	// data blocks referenced so far
+  vector<bool> visited(NUM_BLOCKS, false);	// directories, a corrupt tree may loop
+  vector<short> dirs(1, 1);
+  while (!dirs.empty()) {
+    struct dirblock_t dir;
+    short dir_num = dirs.back();
+    dirs.pop_back();
+    if (!read_block(dir_num, (void *) &dir) || dir.magic != DIR_MAGIC_NUM)
+      continue;
+
+    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
+      short entry = dir.dir_entries[i].block_num;
+      struct inode_t inode;
+      if (entry <= 1 || entry >= NUM_BLOCKS || !read_block(entry, (void *) &inode))
+        continue;
+      // everything in the snapshot directory is read-only
+      bool snapshot = frozen[dir_num] ||
+        (dir_num == 1 && !strncmp(dir.dir_entries[i].name, SNAPSHOT_DIR, MAX_FNAME_SIZE + 1));
+      if (inode.magic == DIR_MAGIC_NUM) {
+        if (!visited[entry])
+          dirs.push_back(entry);
+        visited[entry] = true;
+        frozen[entry] = snapshot;
+        continue;
+      }
+      if (inode.magic != INODE_MAGIC_NUM)
+        continue;
+      frozen[entry] = snapshot;
+      if ((inode.flags & INODE_INLINE) || inode.size > MAX_FILE_SIZE)
+        continue;
 
-  // if the disk exists, return as no further initialization is needed
-  if (!new_disk) return;
+      // every reference after the first is a share
+      for (int b = 0; b * BLOCK_SIZE < inode.size; b++) {
+        short data = inode.blocks[b];
+        if (data <= 1 || data >= NUM_BLOCKS)
+          continue;
+        if (seen[data])
+          allocator.share(data);
+        seen[data] = true;
+      }
+    }
+  }
+}
 
+// Formats a new disk by initializing special blocks 0 (superblock) and
+// 1 (root directory) and zeroing all other blocks.
+void BasicFileSys::format()
+{
   // initialize the superblock
   struct superblock_t super_block;
   super_block.bitmap[0] = 0x3;		// mark blocks 0 and 1 as used
@@ -47,64 +134,221 @@ void BasicFileSys::mount()
 // Unmounts the disk
 void BasicFileSys::unmount()
 {
+  {
+    lock_guard<mutex> guard(prefetch_lock);
+    prefetching = false;
+  }
+  prefetch_cv.notify_one();
+  prefetcher.join();
+  journal.unmount();
   disk.unmount();
 }
 
-// Gets a free block from the disk.
+// Gets a free block from the disk. Returns 0 if the disk is full or
+// the superblock is corrupt. The block is marked used on disk when the
+// calling thread's operation commits.
 short BasicFileSys::get_free_block()
 {
-  // get superblock
-  struct superblock_t super_block;
-  disk.read_block(0, (void *) &super_block);
+  TraceScope trace("get_free_block");
+  return allocator.allocate();
+}
   
-  // look for first available block
-  for (int byte = 0; byte < BLOCK_SIZE; byte++) {
-
-    // check to see if byte has available slot
-    if (super_block.bitmap[byte] != 0xFF) {
- 
-      // loop to check each bit
-      for (int bit = 0; bit < 8; bit++) {
-        int mask = 1 << bit;
-	if (mask & ~super_block.bitmap[byte]) {
-
-          // Available block is found: set bit in bitmap, write result back
-	  // to superblock, and return block number.
-	  super_block.bitmap[byte] |= mask;
-	  disk.write_block(0, (void *) &super_block);
-	  return (byte * 8) + bit;
-	}
-      }
-    }
+// Reclaims block making it available for future use once the calling
+// thread's operation commits. A data block shared with other files
+// only loses the caller's reference.
+void BasicFileSys::reclaim_block(short block_num)
+{
+  TraceScope trace("reclaim_block", block_num);
+  frozen[block_num] = false;
+  dedup.forget(block_num);
+  allocator.release(block_num);
+}
+  
+// Reclaims the n blocks in block_nums at once, like reclaim_block()
+void BasicFileSys::reclaim_blocks(const short *block_nums, int n)
+{
+  TraceScope trace("reclaim_blocks", n);
+  for (int i = 0; i < n; i++) {
+    frozen[block_nums[i]] = false;
+    dedup.forget(block_nums[i]);
   }
+  allocator.release(block_nums, n);
+}
 
-  // disk is full
-  return 0;
+// Adds a reference to data block block_num for another file, which
+// shares it until one of them writes it. Each reference is reclaimed
+// on its own.
+void BasicFileSys::share_block(short block_num)
+{
+  allocator.share(block_num);
 }
-  
-// Reclaims block making it available for future use.
-void BasicFileSys::reclaim_block(short block_num)
+
+// true if more than one file references data block block_num, so a
+// file must write to a copy of it instead
+bool BasicFileSys::block_shared(short block_num)
 {
-  // get superblock
-  struct superblock_t super_block;
-  disk.read_block(0, (void *) &super_block);
+  return allocator.shared(block_num);
+}
 
-  // clear bit
-  int byte = block_num / 8;		// byte number
-  int bit = block_num % 8;		// bit number
-  unsigned char mask = ~(1 << bit);	// mask to clear bit
-  super_block.bitmap[byte] &= mask;
+// Returns a full data block already on disk with the same contents as
+// block, with a reference added for the caller as share_block() adds
+// one, or 0 if there is none
+short BasicFileSys::find_block(const void *block)
+{
+  TraceScope trace("find_block");
+  uint32_t hash = crc32c(block, BLOCK_SIZE);
+  short block_num = dedup.find(hash);
+  if (!block_num)
+    return 0;
 
-  // write back superblock
-  disk.write_block(0, (void *) &super_block);
+  // the hash only picks the block, it is shared if its contents match
+  // and it was not written or released meanwhile
+  datablock_t found;
+  if (!read_block(block_num, (void *) &found) || memcmp(found.data, block, BLOCK_SIZE) != 0)
+    return 0;
+  return dedup.claim(block_num, hash, allocator) ? block_num : 0;
 }
-  
+
+// Lets find_block() find block_num, a full data block the calling
+// thread just wrote as block, once its operation commits
+void BasicFileSys::index_block(short block_num, const void *block)
+{
+  dedup.add(block_num, crc32c(block, BLOCK_SIZE));
+}
+
+// Marks directory or inode block_num as part of a snapshot, which
+// nothing may change until the block is reclaimed
+void BasicFileSys::set_read_only(short block_num)
+{
+  frozen[block_num] = true;
+}
+
+// true if block_num is part of a snapshot
+bool BasicFileSys::read_only(short block_num)
+{
+  return frozen[block_num];
+}
+
 // Reads block from disk. Output parameter block points to new block.
-void BasicFileSys::read_block(short block_num, void *block) {
-  disk.read_block(block_num, block);
+// Returns false if the block does not match its checksum.
+bool BasicFileSys::read_block(short block_num, void *block) {
+  TraceScope trace("read_block", block_num);
+  request_counters.block_reads++;
+
+  // blocks not written home yet are in memory and need no check, nor
+  // do blocks in the cache
+  for (int attempt = 0; attempt < 2; attempt++) {
+    unsigned int gen = cache.generation(block_num);
+    if (journal.read(block_num, block))
+      return true;
+    if (cache.lookup(block_num, block))
+      return true;
+    disk.read_block(block_num, block);
+    request_counters.disk_reads++;
+    if (checksums.verify(block_num, block)) {
+      cache.insert(block_num, block, gen);
+      return true;
+    }
+    // a group commit may have written the block home while it was read,
+    // read it once more before calling it corrupt
+  }
+  cerr << "Block " << block_num << " does not match its checksum" << endl;
+  return false;
+}
+
+// Reads the n blocks in block_nums into the block cache in the
+// background, so read_block() finds them there. Never waits.
+void BasicFileSys::prefetch(const short *block_nums, int n)
+{
+  // a thread that is not waiting takes new blocks without being woken
+  bool wake;
+  {
+    lock_guard<mutex> guard(prefetch_lock);
+    for (int i = 0; i < n && prefetch_count < PREFETCH_QUEUE; i++)
+      prefetch_queue[(prefetch_head + prefetch_count++) % PREFETCH_QUEUE] = block_nums[i];
+    wake = prefetch_idle && prefetch_count > 0;
+  }
+  if (wake)
+    prefetch_cv.notify_one();
+}
+
+// Reads the queued blocks into the cache until unmount
+void BasicFileSys::prefetch_loop()
+{
+  // reading ahead only pays off on a CPU the requests leave idle, such
+  // as while they wait for the network
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), PREFETCH_NICE);
+
+  unique_lock<mutex> guard(prefetch_lock);
+  while (true) {
+    prefetch_idle = true;
+    prefetch_cv.wait(guard, [this]() { return !prefetching || prefetch_count > 0; });
+    prefetch_idle = false;
+    if (!prefetching)
+      return;
+    short block_num = prefetch_queue[prefetch_head];
+    prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE;
+    prefetch_count--;
+    guard.unlock();
+
+    // blocks in the journal or the cache already are read from memory,
+    // corrupt ones are left for the read that needs them to report
+    TraceScope trace("prefetch", block_num);
+    datablock_t block;
+    unsigned int gen = cache.generation(block_num);
+    if (!cache.contains(block_num) && !journal.read(block_num, (void *) &block)) {
+      disk.read_block(block_num, (void *) &block);
+      if (checksums.verify(block_num, (void *) &block))
+        cache.insert(block_num, (void *) &block, gen);
+    }
+    guard.lock();
+  }
 }
 
 // Writes block to disk. Input block points to block to write.
+// The write is part of the calling thread's operation until commit().
 void BasicFileSys::write_block(short block_num, void *block) {
-  disk.write_block(block_num, block);
+  TraceScope trace("write_block", block_num);
+  // a block is not found by its old contents once it is written
+  dedup.forget(block_num);
+  // the journal has the new contents before the cached ones are dropped,
+  // so no read in between caches the old ones
+  journal.write(block_num, block);
+  cache.invalidate(block_num);
+  request_counters.block_writes++;
+}
+
+// Commits the blocks the calling thread wrote since its last commit as
+// one atomic operation, along with its allocations and reclaims. Returns the
+// sequence number to pass to wait_durable() before answering, or 0 if
+// the answer need not wait.
+unsigned int BasicFileSys::commit() {
+  unsigned int seq;
+  if (!allocator.pending()) {
+    seq = journal.commit();
+  } else {
+    // the superblock goes into this transaction with the bitmap of every
+    // operation committed so far plus this one, and reclaimed blocks are
+    // handed out again only once it is committed
+    lock_guard<mutex> guard(super_lock);
+    struct superblock_t super_block;
+    allocator.prepare_commit(&super_block);
+    write_block(0, (void *) &super_block);
+    seq = journal.commit();
+    allocator.finish_commit();
+  }
+
+  // a file sharing a block written by this operation commits after it
+  dedup.commit();
+  return seq;
+}
+
+// Waits until the operation commit() returned seq for is durable.
+void BasicFileSys::wait_durable(unsigned int seq) {
+  journal.wait_durable(seq);
+}
+
+// Sets when operations count as durable, DURABILITY_PERIODIC by default.
+void BasicFileSys::set_durability(Durability mode) {
+  journal.set_durability(mode);
 }
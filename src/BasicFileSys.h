@@ -5,33 +5,135 @@
 #ifndef BASIC_FILESYS_H
 #define BASIC_FILESYS_H
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
 #include "Disk.h"
+#include "Journal.h"
+#include "Checksum.h"
+#include "Allocator.h"
+#include "BlockCache.h"
+#include "DedupIndex.h"
+
+// Most blocks waiting to be read ahead, more are not queued
+const static int PREFETCH_QUEUE = 64;
+
+// Nice value of the read-ahead thread, it runs when the requests let it
+const static int PREFETCH_NICE = 19;
 
 // Basic File 
 class BasicFileSys {
 
   public:
+    // Lets the read-ahead thread go if the process exits still mounted
+    ~BasicFileSys();
+
     // Mounts the disk.  If the disk is new, it formats the disk by
     // initializing special blocks 0 (superblock) and 1 (root directory). 
-    void mount();
+    // file_name is the file that holds the disk.
+    void mount(const char *file_name = "DISK");
 
     // Unmounts the disk.
     void unmount();
 
-    // Gets a free block from the disk.
+    // Gets a free block from the disk. Returns 0 if the disk is full or
+    // the superblock is corrupt. The block is marked used on disk when the
+    // calling thread's operation commits.
     short get_free_block();
   
-    // Reclaims block making it available for future use.
+    // Reclaims block making it available for future use once the calling
+    // thread's operation commits. A data block shared with other files
+    // only loses the caller's reference.
     void reclaim_block(short block_num);
 
+    // Reclaims the n blocks in block_nums at once, like reclaim_block()
+    void reclaim_blocks(const short *block_nums, int n);
+
+    // Adds a reference to data block block_num for another file, which
+    // shares it until one of them writes it. Each reference is reclaimed
+    // on its own.
+    void share_block(short block_num);
+
+    // true if more than one file references data block block_num, so a
+    // file must write to a copy of it instead
+    bool block_shared(short block_num);
+
+    // Returns a full data block already on disk with the same contents as
+    // block, with a reference added for the caller as share_block() adds
+    // one, or 0 if there is none
+    short find_block(const void *block);
+
+    // Lets find_block() find block_num, a full data block the calling
+    // thread just wrote as block, once its operation commits
+    void index_block(short block_num, const void *block);
+
+    // Marks directory or inode block_num as part of a snapshot, which
+    // nothing may change until the block is reclaimed
+    void set_read_only(short block_num);
+
+    // true if block_num is part of a snapshot
+    bool read_only(short block_num);
+
     // Reads block from disk. Output parameter block points to new block.
-    void read_block(short block_num, void *block);
+    // Returns false if the block does not match its checksum.
+    bool read_block(short block_num, void *block);
+
+    // Reads the n blocks in block_nums into the block cache in the
+    // background, so read_block() finds them there. Never waits.
+    void prefetch(const short *block_nums, int n);
   
     // Writes block to disk. Input block points to block to write.
+    // The write is part of the calling thread's operation until commit().
     void write_block(short block_num, void *block);
 
+    // Commits the blocks the calling thread wrote since its last commit as
+    // one atomic operation, along with its allocations and reclaims. Returns the
+    // sequence number to pass to wait_durable() before answering, or 0 if
+    // the answer need not wait.
+    unsigned int commit();
+
+    // Waits until the operation commit() returned seq for is durable.
+    void wait_durable(unsigned int seq);
+
+    // Sets when operations count as durable, DURABILITY_PERIODIC by default.
+    void set_durability(Durability mode);
+
   private:
+    // Counts the files referencing each data block and marks the blocks
+    // of the snapshots read-only, both are only known from the tree
+    void count_refs();
+
     Disk disk;
+    ChecksumTable checksums; // CRC32C of every block, checked on read
+    Journal journal;	// write-ahead journal all block writes go through
+    BlockCache cache;	// blocks read recently or ahead
+
+    // Blocks to read ahead, a ring of PREFETCH_QUEUE entries
+    std::mutex prefetch_lock;
+    std::condition_variable prefetch_cv;
+    short prefetch_queue[PREFETCH_QUEUE];
+    int prefetch_head = 0;	// next block to read
+    int prefetch_count = 0;	// blocks queued
+    bool prefetching = false;	// false once unmount stops the thread
+    bool prefetch_idle = false;	// true while the thread waits for blocks
+    std::thread prefetcher;
+
+    // Reads the queued blocks into the cache until unmount
+    void prefetch_loop();
+
+    Allocator allocator; // free blocks, in allocation groups
+    DedupIndex dedup;	// full data blocks by the hash of their contents
+    std::atomic<bool> frozen[NUM_BLOCKS];	// blocks of a snapshot
+
+    // The superblock is written by one committing operation at a time, so
+    // no transaction logs another one's bitmap bits
+    std::mutex super_lock;
+
+    // Formats a new disk by initializing special blocks 0 (superblock) and
+    // 1 (root directory) and zeroing all other blocks.
+    void format();
 };
 
 #endif
@@ -0,0 +1,83 @@
+// CPSC 3500: Block cache
+// Keeps recently read file system blocks in memory, already checked
+// against their checksums, so reading them again needs neither a disk read
+// nor a checksum. Blocks are dropped when written; the journal holds them
+// until they are home. Read-ahead fills the cache in the background.
+
+#include <cstring>
+using namespace std;
+
+#include "BlockCache.h"
+
+BlockCache::BlockCache()
+{
+  for (int i = 0; i < CACHE_BLOCKS; i++) {
+    entries[i].block_num = -1;
+    entries[i].referenced = false;
+  }
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    slot_of[b] = -1;
+    gens[b] = 0;
+  }
+}
+
+// Copies block_num into block if it is cached. Returns true if it was.
+bool BlockCache::lookup(short block_num, void *block)
+{
+  lock_guard<mutex> guard(lock);
+  int slot = slot_of[block_num];
+  if (slot < 0)
+    return false;
+  entries[slot].referenced = true;
+  memcpy(block, entries[slot].block.data, BLOCK_SIZE);
+  return true;
+}
+
+// true if block_num is cached
+bool BlockCache::contains(short block_num)
+{
+  lock_guard<mutex> guard(lock);
+  return slot_of[block_num] >= 0;
+}
+
+// Returns the generation of block_num, to pass to insert() for a copy
+// of the block read after this call. Takes no lock.
+unsigned int BlockCache::generation(short block_num)
+{
+  return gens[block_num].load();
+}
+
+// Caches block as the contents of block_num, read after generation()
+// returned gen. Nothing is cached if block_num was written since.
+void BlockCache::insert(short block_num, const void *block, unsigned int gen)
+{
+  lock_guard<mutex> guard(lock);
+  if (gens[block_num] != gen || slot_of[block_num] >= 0)
+    return;
+
+  // clock: evict the first entry not read since the hand last passed it
+  while (entries[hand].block_num >= 0 && entries[hand].referenced) {
+    entries[hand].referenced = false;
+    hand = (hand + 1) % CACHE_BLOCKS;
+  }
+  Entry& e = entries[hand];
+  if (e.block_num >= 0)
+    slot_of[e.block_num] = -1;
+  e.block_num = block_num;
+  e.referenced = false;
+  memcpy(e.block.data, block, BLOCK_SIZE);
+  slot_of[block_num] = hand;
+  hand = (hand + 1) % CACHE_BLOCKS;
+}
+
+// Drops block_num, call after each write of it.
+void BlockCache::invalidate(short block_num)
+{
+  lock_guard<mutex> guard(lock);
+  gens[block_num]++;
+  int slot = slot_of[block_num];
+  if (slot >= 0) {
+    entries[slot].block_num = -1;
+    slot_of[block_num] = -1;
+  }
+}
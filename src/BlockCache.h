@@ -0,0 +1,54 @@
+// CPSC 3500: Block cache
+// Keeps recently read file system blocks in memory, already checked
+// against their checksums, so reading them again needs neither a disk read
+// nor a checksum. Blocks are dropped when written; the journal holds them
+// until they are home. Read-ahead fills the cache in the background.
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <mutex>
+#include <atomic>
+
+#include "Blocks.h"
+
+// Number of blocks the cache holds
+const static int CACHE_BLOCKS = 256;
+
+class BlockCache {
+
+  public:
+    BlockCache();
+
+    // Copies block_num into block if it is cached. Returns true if it was.
+    bool lookup(short block_num, void *block);
+
+    // true if block_num is cached
+    bool contains(short block_num);
+
+    // Returns the generation of block_num, to pass to insert() for a copy
+    // of the block read after this call. Takes no lock.
+    unsigned int generation(short block_num);
+
+    // Caches block as the contents of block_num, read after generation()
+    // returned gen. Nothing is cached if block_num was written since.
+    void insert(short block_num, const void *block, unsigned int gen);
+
+    // Drops block_num, call after each write of it.
+    void invalidate(short block_num);
+
+  private:
+    struct Entry {
+      short block_num;	// -1 if the entry is free
+      bool referenced;	// read since the clock hand last passed
+      datablock_t block;
+    };
+
+    std::mutex lock;
+    Entry entries[CACHE_BLOCKS];
+    short slot_of[NUM_BLOCKS];	// entry of each block, -1 if not cached
+    std::atomic<unsigned int> gens[NUM_BLOCKS];	// bumped by every write of the block
+    int hand = 0;	// next entry the clock looks at for eviction
+};
+
+#endif
@@ -14,6 +14,9 @@ const int NUM_BLOCKS = (BLOCK_SIZE * 8);
 // Maximum filename size
 const int MAX_FNAME_SIZE = 9;
 
+// Directory of the root that holds the snapshots, read-only like them
+const char SNAPSHOT_DIR[] = ".snap";
+
 // Maximum number of files in a directory
 const int MAX_DIR_ENTRIES = ((BLOCK_SIZE - 8) / 12);
 
@@ -23,10 +26,51 @@ const int MAX_DATA_BLOCKS = ((BLOCK_SIZE - 8) / 2);
 // Maximum file size for a data file
 const int MAX_FILE_SIZE	= (MAX_DATA_BLOCKS * BLOCK_SIZE);
 
+// Compressed files - the data is split into groups of GROUP_BLOCKS blocks.
+// A full group is stored compressed in the first of its GROUP_BLOCKS slots
+// of blocks[], with its remaining slots 0, unless that saves no block. The
+// first 2 bytes of a compressed group hold its compressed length. A partial
+// group is stored as it is.
+const int GROUP_BLOCKS = 8;
+const int GROUP_SIZE = (GROUP_BLOCKS * BLOCK_SIZE);
+
+// Small files - a file of up to INLINE_SIZE bytes keeps its data in the
+// inode in place of blocks[], so it needs no data block
+const int INLINE_SIZE = (MAX_DATA_BLOCKS * 2);
+
+// Inode flags
+const unsigned short INODE_COMPRESSED = 0x1; // full groups are compressed
+const unsigned short INODE_INLINE = 0x2;     // data is inline_data, not in blocks
+
 // Magic numbers - used to distinguish between directory blocks and inodes
 const unsigned int DIR_MAGIC_NUM = 0xFFFFFFFF;
 const unsigned int INODE_MAGIC_NUM = 0xFFFFFFFE;
 
+// Maximum number of block numbers in one journal descriptor
+const int JDESC_ENTRIES = ((BLOCK_SIZE - 12) / 2);
+
+// Write-ahead journal - stored after the file system blocks so the bitmap
+// still covers exactly NUM_BLOCKS. Block JOURNAL_START is the journal
+// header, the JOURNAL_BLOCKS blocks after it form a circular log. The log
+// holds the largest possible transaction, one that writes every block:
+// its blocks, their descriptors and the commit record.
+const int JOURNAL_START = NUM_BLOCKS;
+const int JOURNAL_BLOCKS = (NUM_BLOCKS + (NUM_BLOCKS + JDESC_ENTRIES - 1) / JDESC_ENTRIES + 1);
+
+// Block checksums - a CRC32C per file system block, stored after the
+// journal in CSUM_BLOCKS blocks of CSUMS_PER_BLOCK checksums each
+const int CSUM_START = (JOURNAL_START + 1 + JOURNAL_BLOCKS);
+const int CSUMS_PER_BLOCK = (BLOCK_SIZE / 4);
+const int CSUM_BLOCKS = (NUM_BLOCKS / CSUMS_PER_BLOCK);
+
+// Total number of blocks in the disk file
+const int DISK_BLOCKS = (CSUM_START + CSUM_BLOCKS);
+
+// Magic numbers of the journal header and log records
+const unsigned int JOURNAL_MAGIC_NUM = 0xFFFFFFFD;
+const unsigned int JDESC_MAGIC_NUM = 0xFFFFFFFC;
+const unsigned int JCOMMIT_MAGIC_NUM = 0xFFFFFFFB;
+
 // BLOCK TYPES
 
 // Superblock - keeps track of which blocks are used in the filesystem.
@@ -48,8 +92,12 @@ struct dirblock_t {
 // Inode - index node for a data file
 struct inode_t {
   unsigned int magic;		 // magic number, must be INODE_MAGIC_NUM
-  unsigned int size;		 // file size in bytes
-  short blocks[MAX_DATA_BLOCKS]; // array of direct indices to data blocks
+  unsigned short size;		 // file size in bytes
+  unsigned short flags;		 // INODE_ flags, 0 on disks from before them
+  union {
+    short blocks[MAX_DATA_BLOCKS]; // array of direct indices to data blocks
+    char inline_data[INLINE_SIZE]; // data of an INODE_INLINE file
+  };
 };
 
 // Data block - stores data for a data file
@@ -57,5 +105,36 @@ struct datablock_t {
   char data[BLOCK_SIZE];	// data (BLOCK_SIZE bytes)
 };
 
+// Journal header - where replay starts after a crash
+struct journal_header_t {
+  unsigned int magic;		// magic number, must be JOURNAL_MAGIC_NUM
+  unsigned int head;		// log block of the oldest transaction to replay
+  unsigned int seq;		// sequence number of that transaction
+  char unused[BLOCK_SIZE - 12];
+};
+
+// Journal descriptor - lists the home block numbers of the log blocks that
+// follow it. A transaction is one or more descriptors with their blocks,
+// closed by a commit record with the same sequence number.
+struct jdesc_t {
+  unsigned int magic;		// magic number, must be JDESC_MAGIC_NUM
+  unsigned int seq;		// sequence number of the transaction
+  unsigned int count;		// number of blocks that follow
+  short block_nums[JDESC_ENTRIES]; // home block number of each
+};
+
+// Checksum block - CRC32C of CSUMS_PER_BLOCK consecutive file system blocks
+struct csumblock_t {
+  unsigned int sums[CSUMS_PER_BLOCK]; // checksum of each block
+};
+
+// Journal commit record - the transaction is complete once it is on disk
+struct jcommit_t {
+  unsigned int magic;		// magic number, must be JCOMMIT_MAGIC_NUM
+  unsigned int seq;		// sequence number of the transaction
+  unsigned int num_blocks;	// number of blocks logged by the transaction
+  char unused[BLOCK_SIZE - 12];
+};
+
 #endif
 
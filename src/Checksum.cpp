@@ -0,0 +1,150 @@
+// CPSC 3500: Block checksums
+// Keeps a CRC32C of every file system block so silent corruption of the
+// disk file is caught when a block is read back. The checksums live in
+// memory and in the checksum region after the journal, and are updated
+// whenever a block is written to its home location.
+
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+using namespace std;
+
+#include "Checksum.h"
+
+// CRC32C polynomial, bit-reversed
+static const uint32_t CRC32C_POLY = 0x82F63B78;
+
+// Lookup tables for slice-by-8: table[k][b] is the CRC of byte b followed
+// by k zero bytes
+struct Crc32cTables {
+  uint32_t table[8][256];
+
+  Crc32cTables() {
+    for (int b = 0; b < 256; b++) {
+      uint32_t crc = b;
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+      table[0][b] = crc;
+    }
+    for (int b = 0; b < 256; b++) {
+      for (int k = 1; k < 8; k++)
+        table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+    }
+  }
+};
+
+static const Crc32cTables tables;
+
+// Portable CRC32C, eight bytes per step
+static uint32_t crc32c_slice8(uint32_t crc, const unsigned char *p, size_t len)
+{
+  const uint32_t (*t)[256] = tables.table;
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    v ^= crc;
+    crc = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^
+          t[4][(v >> 24) & 0xFF] ^ t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^
+          t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+  return crc;
+}
+
+#if defined(__x86_64__)
+// CRC32C with the SSE4.2 crc32 instruction, eight bytes per step
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc64 = _mm_crc32_u64(crc64, v);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t) crc64;
+  while (len--)
+    crc = _mm_crc32_u8(crc, *p++);
+  return crc;
+}
+#endif
+
+// picks the fastest implementation the CPU supports
+static uint32_t (*pick_crc32c())(uint32_t, const unsigned char *, size_t)
+{
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2"))
+    return crc32c_sse42;
+#endif
+  return crc32c_slice8;
+}
+
+static uint32_t (*const crc32c_impl)(uint32_t, const unsigned char *, size_t) = pick_crc32c();
+
+// CRC32C (Castagnoli) of len bytes of data, using the SSE4.2 crc32
+// instruction if the CPU has it and slice-by-8 tables otherwise
+uint32_t crc32c(const void *data, size_t len)
+{
+  return ~crc32c_impl(~0u, (const unsigned char *) data, len);
+}
+
+// Loads the checksums stored on disk, or computes them from the file
+// system blocks if the disk has no checksum region yet.
+void ChecksumTable::mount(Disk *disk)
+{
+  this->disk = disk;
+
+  if (disk->num_blocks() >= DISK_BLOCKS) {
+    for (int i = 0; i < CSUM_BLOCKS; i++) {
+      csumblock_t block;
+      disk->read_block(CSUM_START + i, (void *) &block);
+      for (int j = 0; j < CSUMS_PER_BLOCK; j++)
+        sums[i * CSUMS_PER_BLOCK + j] = block.sums[j];
+      dirty[i] = false;
+    }
+    return;
+  }
+
+  // a disk from before checksums: trust its blocks as they are
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    datablock_t block;
+    disk->read_block(b, (void *) &block);
+    sums[b] = crc32c(block.data, BLOCK_SIZE);
+  }
+  for (int i = 0; i < CSUM_BLOCKS; i++)
+    dirty[i] = true;
+  flush();
+}
+
+// Records the checksum of block, just written home as block_num.
+void ChecksumTable::update(short block_num, const void *block)
+{
+  sums[block_num].store(crc32c(block, BLOCK_SIZE), memory_order_relaxed);
+  dirty[block_num / CSUMS_PER_BLOCK].store(true, memory_order_release);
+}
+
+// true if block matches the checksum recorded for block_num
+bool ChecksumTable::verify(short block_num, const void *block) const
+{
+  return crc32c(block, BLOCK_SIZE) == sums[block_num].load(memory_order_relaxed);
+}
+
+// Writes the checksum blocks changed since the last flush to disk.
+void ChecksumTable::flush()
+{
+  lock_guard<mutex> guard(flush_lock);
+  for (int i = 0; i < CSUM_BLOCKS; i++) {
+    if (!dirty[i].exchange(false, memory_order_acquire))
+      continue;
+    csumblock_t block;
+    for (int j = 0; j < CSUMS_PER_BLOCK; j++)
+      block.sums[j] = sums[i * CSUMS_PER_BLOCK + j].load(memory_order_relaxed);
+    disk->write_block(CSUM_START + i, (void *) &block);
+  }
+}
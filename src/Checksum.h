@@ -0,0 +1,46 @@
+// CPSC 3500: Block checksums
+// Keeps a CRC32C of every file system block so silent corruption of the
+// disk file is caught when a block is read back. The checksums live in
+// memory and in the checksum region after the journal, and are updated
+// whenever a block is written to its home location.
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Disk.h"
+#include "Blocks.h"
+
+// CRC32C (Castagnoli) of len bytes of data, using the SSE4.2 crc32
+// instruction if the CPU has it and slice-by-8 tables otherwise
+uint32_t crc32c(const void *data, size_t len);
+
+class ChecksumTable {
+
+  public:
+    // Loads the checksums stored on disk, or computes them from the file
+    // system blocks if the disk has no checksum region yet.
+    void mount(Disk *disk);
+
+    // Records the checksum of block, just written home as block_num.
+    void update(short block_num, const void *block);
+
+    // true if block matches the checksum recorded for block_num
+    bool verify(short block_num, const void *block) const;
+
+    // Writes the checksum blocks changed since the last flush to disk.
+    void flush();
+
+  private:
+    Disk *disk;
+
+    std::atomic<uint32_t> sums[NUM_BLOCKS];	// checksum of each block
+    std::atomic<bool> dirty[CSUM_BLOCKS];	// checksum blocks not written yet
+    std::mutex flush_lock;			// one flush at a time
+};
+
+#endif
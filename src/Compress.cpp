@@ -0,0 +1,157 @@
+// CPSC 3500: Block compression
+// A small LZ77 codec in the style of LZ4, used to store the full block
+// groups of compressed files in fewer blocks. Text compresses well with it
+// and both directions run at memory speed.
+//
+// Compressed data is a list of sequences. Each starts with a token byte,
+// the high nibble the number of literals and the low nibble the match
+// length minus LZ_MIN_MATCH, a nibble of 15 meaning more length bytes
+// follow (each adds up to 255, a byte below 255 ends them). The literals
+// come next, then the 2-byte little-endian distance back to the match.
+// The last sequence has literals only.
+
+#include <cstring>
+#include <stdint.h>
+using namespace std;
+
+#include "Compress.h"
+
+// Shortest match worth encoding
+static const int LZ_MIN_MATCH = 4;
+
+// Matches are found through a hash table of the last position of each
+// 4-byte sequence
+static const int LZ_HASH_BITS = 12;
+
+// Farthest a match can be, the distance has to fit in 2 bytes
+static const int LZ_MAX_DISTANCE = 65535;
+
+// Appends length n in the nibble and length byte encoding, returns false
+// if it does not fit
+static bool put_length(unsigned char *dst, int& pos, int cap, int n)
+{
+  for (n -= 15; n >= 255; n -= 255) {
+    if (pos >= cap)
+      return false;
+    dst[pos++] = 255;
+  }
+  if (pos >= cap)
+    return false;
+  dst[pos++] = n;
+  return true;
+}
+
+// Appends one sequence: num_lits literals, then a match of match_len bytes
+// distance bytes back unless match_len is 0. Returns false if it does not
+// fit.
+static bool put_sequence(unsigned char *dst, int& pos, int cap, const unsigned char *lits,
+                         int num_lits, int distance, int match_len)
+{
+  int match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+  if (pos >= cap)
+    return false;
+  dst[pos++] = (num_lits < 15 ? num_lits : 15) << 4 | (match_code < 15 ? match_code : 15);
+  if (num_lits >= 15 && !put_length(dst, pos, cap, num_lits))
+    return false;
+  if (pos + num_lits > cap)
+    return false;
+  memcpy(dst + pos, lits, num_lits);
+  pos += num_lits;
+  if (match_len == 0)
+    return true;
+  if (pos + 2 > cap)
+    return false;
+  dst[pos++] = distance & 0xFF;
+  dst[pos++] = distance >> 8;
+  return match_code < 15 || put_length(dst, pos, cap, match_code);
+}
+
+// Reads a length continued in length bytes onto n, returns false if the
+// input ends first
+static bool get_length(const unsigned char *src, int& pos, int len, int& n)
+{
+  unsigned char b;
+  do {
+    if (pos >= len)
+      return false;
+    b = src[pos++];
+    n += b;
+  } while (b == 255);
+  return true;
+}
+
+// Compresses len bytes of src into at most cap bytes of dst. Returns the
+// compressed size, or -1 if it does not fit in cap bytes.
+int lz_compress(const char *src, int len, char *dst, int cap)
+{
+  const unsigned char *in = (const unsigned char *) src;
+  unsigned char *out = (unsigned char *) dst;
+  int table[1 << LZ_HASH_BITS];
+  for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+    table[i] = -1;
+
+  int pos = 0;		// output size so far
+  int anchor = 0;	// first input byte not encoded yet
+  int ip = 0;		// input position being matched
+  while (ip + LZ_MIN_MATCH <= len) {
+    uint32_t seq;
+    memcpy(&seq, in + ip, 4);
+    int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    int ref = table[h];
+    table[h] = ip;
+    if (ref < 0 || ip - ref > LZ_MAX_DISTANCE || memcmp(in + ref, in + ip, LZ_MIN_MATCH) != 0) {
+      ip++;
+      continue;
+    }
+
+    int match_len = LZ_MIN_MATCH;
+    while (ip + match_len < len && in[ref + match_len] == in[ip + match_len])
+      match_len++;
+    if (!put_sequence(out, pos, cap, in + anchor, ip - anchor, ip - ref, match_len))
+      return -1;
+    ip += match_len;
+    anchor = ip;
+  }
+  if (!put_sequence(out, pos, cap, in + anchor, len - anchor, 0, 0))
+    return -1;
+  return pos;
+}
+
+// Decompresses len bytes of src into at most cap bytes of dst. Returns the
+// decompressed size, or -1 if src is not valid compressed data.
+int lz_decompress(const char *src, int len, char *dst, int cap)
+{
+  const unsigned char *in = (const unsigned char *) src;
+  unsigned char *out = (unsigned char *) dst;
+  int ip = 0, op = 0;
+  while (ip < len) {
+    unsigned char token = in[ip++];
+
+    int num_lits = token >> 4;
+    if (num_lits == 15 && !get_length(in, ip, len, num_lits))
+      return -1;
+    if (ip + num_lits > len || op + num_lits > cap)
+      return -1;
+    memcpy(out + op, in + ip, num_lits);
+    ip += num_lits;
+    op += num_lits;
+    if (ip == len)
+      break;
+
+    if (ip + 2 > len)
+      return -1;
+    int distance = in[ip] | in[ip + 1] << 8;
+    ip += 2;
+    int match_len = token & 15;
+    if (match_len == 15 && !get_length(in, ip, len, match_len))
+      return -1;
+    match_len += LZ_MIN_MATCH;
+    if (distance == 0 || distance > op || op + match_len > cap)
+      return -1;
+
+    // byte by byte, a match may overlap the bytes it produces
+    for (int i = 0; i < match_len; i++, op++)
+      out[op] = out[op - distance];
+  }
+  return op;
+}
@@ -0,0 +1,17 @@
+// CPSC 3500: Block compression
+// A small LZ77 codec in the style of LZ4, used to store the full block
+// groups of compressed files in fewer blocks. Text compresses well with it
+// and both directions run at memory speed.
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+// Compresses len bytes of src into at most cap bytes of dst. Returns the
+// compressed size, or -1 if it does not fit in cap bytes.
+int lz_compress(const char *src, int len, char *dst, int cap);
+
+// Decompresses len bytes of src into at most cap bytes of dst. Returns the
+// decompressed size, or -1 if src is not valid compressed data.
+int lz_decompress(const char *src, int len, char *dst, int cap);
+
+#endif
@@ -0,0 +1,96 @@
+// CPSC 3500: Dedup index
+// Finds a full data block already on disk by the hash of its contents, so
+// a file writing the same contents can share that block instead of
+// writing a new one. A block becomes findable once the operation that
+// wrote it commits, and is forgotten as soon as it is written again or
+// released, so a block found here is never free. The hash only picks the
+// candidate, the caller compares the contents.
+
+#include <vector>
+#include <utility>
+using namespace std;
+
+#include "DedupIndex.h"
+
+// Blocks the calling thread wrote since its last commit, with their hashes
+static thread_local vector<pair<short, uint32_t> > added;
+
+DedupIndex::DedupIndex()
+{
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    hashes[b] = 0;
+    listed[b] = false;
+  }
+}
+
+// Returns the block indexed with hash, or 0 if there is none
+short DedupIndex::find(uint32_t hash)
+{
+  lock_guard<mutex> guard(lock);
+  unordered_map<uint32_t, short>::iterator it = by_hash.find(hash);
+  return it == by_hash.end() ? 0 : it->second;
+}
+
+// Adds a reference to block_num through allocator if it is still
+// indexed with hash. Returns true if it was.
+bool DedupIndex::claim(short block_num, uint32_t hash, Allocator& allocator)
+{
+  // a release forgets the block under the lock first, so the reference
+  // is taken before the release is decided
+  lock_guard<mutex> guard(lock);
+  if (!listed[block_num] || hashes[block_num] != hash)
+    return false;
+  allocator.share(block_num);
+  return true;
+}
+
+// Indexes block_num, a full data block the calling thread wrote with
+// contents hash, once its operation commits
+void DedupIndex::add(short block_num, uint32_t hash)
+{
+  added.push_back(make_pair(block_num, hash));
+}
+
+// Forgets block_num, call before each write or release of it
+void DedupIndex::forget(short block_num)
+{
+  for (size_t i = 0; i < added.size(); i++) {
+    if (added[i].first == block_num) {
+      added[i] = added.back();
+      added.pop_back();
+      break;
+    }
+  }
+  if (!listed[block_num].load(memory_order_acquire))
+    return;
+
+  lock_guard<mutex> guard(lock);
+  if (!listed[block_num])
+    return;
+  listed[block_num] = false;
+  unordered_map<uint32_t, short>::iterator it = by_hash.find(hashes[block_num]);
+  if (it != by_hash.end() && it->second == block_num)
+    by_hash.erase(it);
+}
+
+// Indexes the blocks the calling thread added, call once its
+// operation is committed
+void DedupIndex::commit()
+{
+  if (added.empty())
+    return;
+
+  // a newer block with the same hash takes the older one's place
+  lock_guard<mutex> guard(lock);
+  for (size_t i = 0; i < added.size(); i++) {
+    short b = added[i].first;
+    uint32_t hash = added[i].second;
+    short& slot = by_hash[hash];
+    if (slot && slot != b)
+      listed[slot] = false;
+    slot = b;
+    hashes[b] = hash;
+    listed[b] = true;
+  }
+  added.clear();
+}
@@ -0,0 +1,50 @@
+// CPSC 3500: Dedup index
+// Finds a full data block already on disk by the hash of its contents, so
+// a file writing the same contents can share that block instead of
+// writing a new one. A block becomes findable once the operation that
+// wrote it commits, and is forgotten as soon as it is written again or
+// released, so a block found here is never free. The hash only picks the
+// candidate, the caller compares the contents.
+
+#ifndef DEDUP_INDEX_H
+#define DEDUP_INDEX_H
+
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "Blocks.h"
+#include "Allocator.h"
+
+class DedupIndex {
+
+  public:
+    DedupIndex();
+
+    // Returns the block indexed with hash, or 0 if there is none
+    short find(uint32_t hash);
+
+    // Adds a reference to block_num through allocator if it is still
+    // indexed with hash. Returns true if it was.
+    bool claim(short block_num, uint32_t hash, Allocator& allocator);
+
+    // Indexes block_num, a full data block the calling thread wrote with
+    // contents hash, once its operation commits
+    void add(short block_num, uint32_t hash);
+
+    // Forgets block_num, call before each write or release of it
+    void forget(short block_num);
+
+    // Indexes the blocks the calling thread added, call once its
+    // operation is committed
+    void commit();
+
+  private:
+    std::mutex lock;
+    std::unordered_map<uint32_t, short> by_hash;	// block of each hash
+    uint32_t hashes[NUM_BLOCKS];	// hash each indexed block is under
+    std::atomic<bool> listed[NUM_BLOCKS];	// read without the lock to skip most writes
+};
+
+#endif
@@ -0,0 +1,134 @@
+// CPSC 3500: Directory cache
+// Immutable in-memory versions of the directory blocks, so lookups need no
+// locks. A directory change builds a new version and publishes it with an
+// atomic pointer swap; readers keep using the version they loaded. Readers
+// announce the epoch they started in, and a replaced version is freed only
+// once every reader that could still hold it has finished.
+
+using namespace std;
+
+#include "DirCache.h"
+
+// Epoch a thread is reading in, 0 while it is not reading. Slots are
+// never freed, a thread that exits leaves its slot to the next one.
+struct EpochSlot {
+  atomic<unsigned long> epoch{0};
+  atomic<bool> in_use{true};
+  EpochSlot* next = NULL;
+};
+
+static atomic<unsigned long> global_epoch(1);
+static atomic<EpochSlot*> slots(NULL);	// every slot ever claimed
+
+// The calling thread's slot, claimed on its first read
+struct ThreadSlot {
+  EpochSlot* slot = NULL;
+  int depth = 0;	// Readers alive on the thread
+
+  EpochSlot* get() {
+    if(slot)
+      return slot;
+    for(EpochSlot* s = slots.load(); s; s = s->next) {
+      bool free_slot = false;
+      if(s->in_use.compare_exchange_strong(free_slot, true))
+        return slot = s;
+    }
+    slot = new EpochSlot;
+    slot->next = slots.load();
+    while(!slots.compare_exchange_weak(slot->next, slot))
+      ;
+    return slot;
+  }
+
+  ~ThreadSlot() {
+    if(slot)
+      slot->in_use = false;
+  }
+};
+
+static thread_local ThreadSlot this_slot;
+
+DirCache::DirCache() {
+  for(int i = 0; i < NUM_BLOCKS; i++)
+    versions[i] = NULL;
+}
+
+DirCache::~DirCache() {
+  for(int i = 0; i < NUM_BLOCKS; i++)
+    delete versions[i].load();
+  for(size_t i = 0; i < retired.size(); i++)
+    delete retired[i].version;
+}
+
+// Marks the calling thread as reading versions until it goes out of
+// scope, for every DirCache as they share one epoch. Versions may only
+// be used while a Reader is alive, and Readers nest.
+DirCache::Reader::Reader() {
+  //The epoch is announced before any version is loaded
+  if(this_slot.depth++ == 0)
+    this_slot.get()->epoch = global_epoch.load();
+}
+
+DirCache::Reader::~Reader() {
+  if(--this_slot.depth == 0)
+    this_slot.slot->epoch = 0;
+}
+
+// Returns the current version of directory blk_num, NULL if it is not
+// cached. Never blocks.
+const DirVersion* DirCache::get(short blk_num) {
+  return versions[blk_num].load();
+}
+
+// Caches version as read from disk if nothing is cached for blk_num
+// yet, and returns the version now cached. Takes ownership of version.
+// Callers hold the directory's lock, shared or exclusive.
+const DirVersion* DirCache::fill(short blk_num, DirVersion* version) {
+  //Another reader holding the shared lock may have filled it first
+  const DirVersion* cached = NULL;
+  if(versions[blk_num].compare_exchange_strong(cached, version))
+    return version;
+  delete version;
+  return cached;
+}
+
+// Publishes version as the new version of directory blk_num. Takes
+// ownership of version. Callers hold the directory's exclusive lock.
+void DirCache::publish(short blk_num, DirVersion* version) {
+  const DirVersion* old = versions[blk_num].exchange(version);
+  if(old)
+    retire(old);
+}
+
+// Drops directory blk_num once it is removed. Callers hold the
+// directory's exclusive lock.
+void DirCache::drop(short blk_num) {
+  const DirVersion* old = versions[blk_num].exchange(NULL);
+  if(old)
+    retire(old);
+}
+
+// Frees version once no reader can hold it anymore, along with every
+// other retired version that is safe to free by now
+void DirCache::retire(const DirVersion* version) {
+  //Readers that announce a later epoch started after version was replaced
+  Retired r = {version, global_epoch.fetch_add(1)};
+  lock_guard<mutex> guard(retired_lock);
+  retired.push_back(r);
+
+  //The readers are scanned after every retired version was replaced
+  unsigned long oldest = ~0UL;
+  for(EpochSlot* s = slots.load(); s; s = s->next) {
+    unsigned long e = s->epoch.load();
+    if(e != 0 && e < oldest)
+      oldest = e;
+  }
+  size_t kept = 0;
+  for(size_t i = 0; i < retired.size(); i++) {
+    if(retired[i].epoch < oldest)
+      delete retired[i].version;
+    else
+      retired[kept++] = retired[i];
+  }
+  retired.resize(kept);
+}
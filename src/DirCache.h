@@ -0,0 +1,77 @@
+// CPSC 3500: Directory cache
+// Immutable in-memory versions of the directory blocks, so lookups need no
+// locks. A directory change builds a new version and publishes it with an
+// atomic pointer swap; readers keep using the version they loaded. Readers
+// announce the epoch they started in, and a replaced version is freed only
+// once every reader that could still hold it has finished.
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Blocks.h"
+
+// One version of a directory, never changed once published
+struct DirVersion {
+  dirblock_t block;			// the directory block
+  bool subdir[MAX_DIR_ENTRIES];	// true if the entry is a directory
+};
+
+class DirCache {
+
+  public:
+    DirCache();
+    ~DirCache();
+
+    // Marks the calling thread as reading versions until it goes out of
+    // scope, for every DirCache as they share one epoch. Versions may only
+    // be used while a Reader is alive, and Readers nest.
+    class Reader {
+      public:
+        Reader();
+        ~Reader();
+      private:
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+    };
+
+    // Returns the current version of directory blk_num, NULL if it is not
+    // cached. Never blocks.
+    const DirVersion* get(short blk_num);
+
+    // Caches version as read from disk if nothing is cached for blk_num
+    // yet, and returns the version now cached. Takes ownership of version.
+    // Callers hold the directory's lock, shared or exclusive.
+    const DirVersion* fill(short blk_num, DirVersion* version);
+
+    // Publishes version as the new version of directory blk_num. Takes
+    // ownership of version. Callers hold the directory's exclusive lock.
+    void publish(short blk_num, DirVersion* version);
+
+    // Drops directory blk_num once it is removed. Callers hold the
+    // directory's exclusive lock.
+    void drop(short blk_num);
+
+  private:
+    // A replaced version and the epoch it was replaced in
+    struct Retired {
+      const DirVersion* version;
+      unsigned long epoch;
+    };
+
+    std::atomic<const DirVersion*> versions[NUM_BLOCKS];
+    std::mutex retired_lock;
+    std::vector<Retired> retired;	// waiting for their readers to finish
+
+    // Frees version once no reader can hold it anymore, along with every
+    // other retired version that is safe to free by now
+    void retire(const DirVersion* version);
+
+    DirCache(const DirCache&) = delete;
+    DirCache& operator=(const DirCache&) = delete;
+};
+
+#endif
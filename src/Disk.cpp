@@ -1,5 +1,7 @@
 // CPSC 3500:  A "virtual" Disk
 // This implements a simulated disk consisting of an array of blocks.
+// Blocks are read and written with pread/pwrite, so several threads can
+// use the disk at once.
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -39,22 +41,15 @@ void Disk::unmount()
 void Disk::read_block(int block_num, void *block)
 {
   off_t offset;
-  off_t new_offset;
   ssize_t size; 
 
-  if (block_num < 0 || block_num >= NUM_BLOCKS) {
+  if (block_num < 0 || block_num >= DISK_BLOCKS) {
     cerr << "Invalid block size" << endl;
     exit(-1);
   }
 
   offset = block_num * BLOCK_SIZE;
-  new_offset = lseek(fd, offset, SEEK_SET);
-  if (offset != new_offset) {
-    cerr << "Seek failure" << endl;
-    exit(-1);
-  }
-
-  size = read(fd, block, BLOCK_SIZE);
+  size = pread(fd, block, BLOCK_SIZE, offset);
   if (size != BLOCK_SIZE) {
     cerr << "Failed to read entire block" << endl;
     exit(-1);
@@ -65,24 +60,37 @@ void Disk::read_block(int block_num, void *block)
 void Disk::write_block(int block_num, void *block)
 {
   off_t offset;
-  off_t new_offset;
   ssize_t size; 
 
-  if (block_num < 0 || block_num >= NUM_BLOCKS) {
+  if (block_num < 0 || block_num >= DISK_BLOCKS) {
     cerr << "Invalid block size" << endl;
     exit(-1);
   }
 
   offset = block_num * BLOCK_SIZE;
-  new_offset = lseek(fd, offset, SEEK_SET);
-  if (offset != new_offset) {
-    cerr << "Seek failure" << endl;
+  size = pwrite(fd, block, BLOCK_SIZE, offset);
+  if (size != BLOCK_SIZE) {
+    cerr << "Failed to write entire block" << endl;
     exit(-1);
   }
+}
 
-  size = write(fd, block, BLOCK_SIZE);
-  if (size != BLOCK_SIZE) {
-    cerr << "Failed to write entire block" << endl;
+// Flushes all written blocks to stable storage.
+void Disk::sync()
+{
+  if (fsync(fd) == -1) {
+    cerr << "Failed to sync disk" << endl;
+    exit(-1);
+  }
+}
+
+// Returns the number of whole blocks in the disk file.
+int Disk::num_blocks()
+{
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    cerr << "Failed to stat disk" << endl;
     exit(-1);
   }
+  return st.st_size / BLOCK_SIZE;
 }
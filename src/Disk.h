@@ -1,5 +1,7 @@
 // CPSC 3500: A "virtual" Disk
 // This implements a simulated disk consisting of an array of blocks.
+// Blocks are read and written with pread/pwrite, so several threads can
+// use the disk at once.
 
 #ifndef DISK_H
 #define DISK_H
@@ -21,6 +23,12 @@ class Disk {
     // Writes the data in block to disk block block_num.
     void write_block(int block_num, void *block);
 
+    // Flushes all written blocks to stable storage.
+    void sync();
+
+    // Returns the number of whole blocks in the disk file.
+    int num_blocks();
+
   private:
     int fd;	// file descriptor that represents the disk
 };
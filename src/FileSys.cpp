@@ -5,29 +5,63 @@
 #include <iostream>
 #include <unistd.h>
 #include <string>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <algorithm>
 using namespace std;
 
 #include "FileSys.h"
 #include "BasicFileSys.h"
 #include "Blocks.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Compress.h"
+
+// creates a client session on the shared basic file system, lease
+// table, block locks, directory cache and inode table, the disk must
+// already be mounted
+FileSys::FileSys(BasicFileSys& bfs, LeaseTable& lease_table, LockTable& locks, DirCache& dirs,
+                 InodeTable& inodes)
+  : bfs(bfs), lease_table(lease_table), locks(locks), dirs(dirs), inodes(inodes) {
+}
 
 // mounts the file system
 void FileSys::mount(int sock) {
-  bfs.mount();
   curr_dir = 1; //by default current directory is home directory, in disk block #1
+  inodes.pin(curr_dir);
   fs_sock = sock; //use this socket to receive file system operations from the client and send back response messages
+  for(int fd = 0; fd < MAX_HANDLES; fd++)
+    handles[fd] = 0;
+
+  static atomic<int> num_sessions(0);
+  session = ++num_sessions;
+  lease_on = false;
 }
 
 // unmounts the file system
+// The disk stays mounted for the other sessions
 void FileSys::unmount() {
-  bfs.unmount();
-  close(fs_sock);
+  //The session stops using its cwd and open files, once
+  if(curr_dir) {
+    for(int fd = 0; fd < MAX_HANDLES; fd++) {
+      if(handles[fd])
+        inodes.unpin(handles[fd]);
+      handles[fd] = 0;
+    }
+    inodes.unpin(curr_dir);
+    curr_dir = 0;
+  }
+  ::close(fs_sock);
 }
 
 // make a directory
 void FileSys::mkdir(const char *name)
 {
   size_t len_name = strlen(name);
+  BlockLock cwd_lock(locks, curr_dir, LOCK_EXCLUSIVE);
+  if(!checkerr_514(curr_dir) || !checkerr_516(curr_dir, name))
+    return;
 
   //Get free block number and check for errors 504 & 505
   short blk_num = checkerr_504_505(len_name);
@@ -43,7 +77,13 @@ void FileSys::mkdir(const char *name)
   bfs.write_block(blk_num, (void*) &dblk);
 
   //Update cwd dir_entries and check for errors 502 & 506
-  if(add_cwd(blk_num, name, len_name)) {
+  if(add_cwd(blk_num, name, true)) {
+    //Cache the new directory, nothing could look it up before add_cwd
+    DirVersion* version = new DirVersion;
+    version->block = dblk;
+    for(int i = 0; i < MAX_DIR_ENTRIES; i++)
+      version->subdir[i] = false;
+    dirs.publish(blk_num, version);
     send_msg(200);
   }
 }
@@ -51,50 +91,73 @@ void FileSys::mkdir(const char *name)
 // switch to a directory
 void FileSys::cd(const char *name)
 {
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void*)&cwdblk);
-  
-  //Get block number for directory and check for errors 500 & 503
-  dirblock_t dblk;
-  short blk_num = checkerr_500_503((void*)&cwdblk, (void*)&dblk, name);
-  if(!blk_num)
-    return;
+  //Get curr dir version, looked up without locks
+  DirCache::Reader reader;
+  const DirVersion* cwd = get_dir(curr_dir);
+  while(cwd) {
+    //Get block number for directory and check for errors 500 & 503
+    //The directory is locked so it is not removed before it is the cwd,
+    //it is only still there if the cwd is unchanged
+    BlockLock dir_lock(locks, LOCK_SHARED);
+    short blk_num = checkerr_500_503(cwd, name, &dir_lock);
+    if(!blk_num)
+      return;
+    const DirVersion* now = dirs.get(curr_dir);
+    if(now != cwd) {
+      cwd = now ? now : get_dir(curr_dir);
+      continue;
+    }
 
-  curr_dir = blk_num;
-  send_msg(200);
+    set_cwd(blk_num);
+    send_msg(200);
+    return;
+  }
 }
 
 // switch to home directory
 void FileSys::home() {
-  curr_dir = 1;
+  set_cwd(1);
   send_msg(200);
 }
 
 // remove a directory
 void FileSys::rmdir(const char *name)
 {
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void*)&cwdblk);
+  //Get curr dir version
+  BlockLock cwd_lock(locks, curr_dir, LOCK_EXCLUSIVE);
+  const DirVersion* cwd = get_dir(curr_dir, true);
+  if(!cwd)
+    return;
   
   //Get block number for directory and check for errors 500 & 503
-  dirblock_t rmdirblk;
-  short blk_num = checkerr_500_503((void*)&cwdblk, (void*)&rmdirblk, name);
-  if(!blk_num)
+  //The directory stays locked so nothing is created in it meanwhile
+  BlockLock dir_lock(locks, LOCK_EXCLUSIVE);
+  short blk_num = checkerr_500_503(cwd, name, &dir_lock);
+  if(!blk_num || !checkerr_514(blk_num))
+    return;
+  const DirVersion* rmdir = get_dir(blk_num, true);
+  if(!rmdir)
     return;
 
   //Check for error 507
-  if(rmdirblk.num_entries) {
+  if(rmdir->block.num_entries) {
     send_msg(507);
     return;
   }
 
+  //Check for error 510, a session in it would go on using a freed block
+  if(inodes.pinned(blk_num)) {
+    send_msg(510);
+    return;
+  }
+
   //Remove sub directory
+  revoke_leases(blk_num);
+  dirs.drop(blk_num);
   bfs.reclaim_block(blk_num);
 
   //Remove entry from curr dir
-  rem_cwd((void*)&cwdblk, blk_num);
+  rem_cwd(cwd, blk_num);
 
   send_msg(200);
 }
@@ -102,39 +165,48 @@ void FileSys::rmdir(const char *name)
 // list the contents of current directory
 void FileSys::ls()
 {
-  string output = "";
-
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void *) &cwdblk);
+  //Room for every entry name, a slash and a space
+  char* output = arena.alloc_array<char>(MAX_DIR_ENTRIES * (MAX_FNAME_SIZE + 2));
+  int len = 0;
+
+  //Get curr dir version, looked up without locks
+  DirCache::Reader reader;
+  const DirVersion* cwd = get_dir(curr_dir);
+  if(!cwd)
+    return;
+  const dirblock_t& cwdblk = cwd->block;
   //Display entry list
   int i = 0;
   int loop_amt = cwdblk.num_entries;
   while(i < loop_amt) {
     //Skip deleted entries or free entry spots
     if(cwdblk.dir_entries[i].block_num > 0) { 
-      output += cwdblk.dir_entries[i].name;
-      //Read the entry block and check if its a directory
-      dirblock_t entryblk;
-      bfs.read_block(cwdblk.dir_entries[i].block_num, (void *) &entryblk);
-      if(is_dir((void*)&entryblk))
-        output += "/";
+      const char* entry = cwdblk.dir_entries[i].name;
+      int len_entry = strnlen(entry, MAX_FNAME_SIZE + 1);
+      memcpy(output + len, entry, len_entry);
+      len += len_entry;
+      //The version knows which entries are directories
+      if(cwd->subdir[i])
+        output[len++] = '/';
 
       if(i != loop_amt - 1) {
-        output += " ";
+        output[len++] = ' ';
       }
     } else {
       loop_amt++; //Inc the amt of iterations
     }
     i++;
   } 
-  send_msg(200, output);
+  send_msg(200, output, len);
 }
 
 // create an empty data file
 void FileSys::create(const char *name)
 {
   size_t len_name = strlen(name);
+  BlockLock cwd_lock(locks, curr_dir, LOCK_EXCLUSIVE);
+  if(!checkerr_514(curr_dir) || !checkerr_516(curr_dir, name))
+    return;
 
   //Get free block number and check for errors 504 & 505
   short inode_num = checkerr_504_505(len_name);
@@ -145,12 +217,13 @@ void FileSys::create(const char *name)
   inode_t inode;
   inode.magic = INODE_MAGIC_NUM;
   inode.size = 0;
+  inode.flags = INODE_INLINE | (compress_files ? INODE_COMPRESSED : 0);
   for(int i = 0; i < MAX_DATA_BLOCKS; i++)
     inode.blocks[i] = 0;
   bfs.write_block(inode_num, (void*) &inode);
 
   //Update cwd dir_entries and check for errors 502 & 506
-  if(add_cwd(inode_num, name, len_name)) {
+  if(add_cwd(inode_num, name)) {
     send_msg(200);
   }
 }
@@ -158,16 +231,22 @@ void FileSys::create(const char *name)
 // append data to a data file
 void FileSys::append(const char *name, const char *data)
 {
-
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void*)&cwdblk);
-
   //Get inode and block number for file and check for errors 501 & 503
+  //Only the file is locked, the cwd is looked up without locks
+  BlockLock file_lock(locks, LOCK_EXCLUSIVE);
   inode_t inode;
-  short inode_num = checkerr_501_503((void*)&cwdblk, (void*)&inode, name);
+  short inode_num = checkerr_501_503((void*)&inode, name, &file_lock);
   if(!inode_num)
     return;
+  append_file(inode_num, inode, data);
+}
+
+// appends data to the file, the file must be locked exclusively
+void FileSys::append_file(short inode_num, inode_t& inode, const char *data)
+{
+  //Files of a snapshot keep their data
+  if(!checkerr_514(inode_num))
+    return;
 
   //Check if total data being appended would exceed the max file size
   int len_data = strlen(data);
@@ -175,14 +254,46 @@ void FileSys::append(const char *name, const char *data)
     send_msg(508);
     return;
   }
-  
+
+
+  //Small files keep their data in the inode
+  if(inode.flags & INODE_INLINE) {
+    if(inode.size + len_data <= INLINE_SIZE) {
+      memcpy(inode.inline_data + inode.size, data, len_data);
+      inode.size += len_data;
+      revoke_leases(inode_num);
+      write_inode(inode_num, inode);
+      send_msg(200);
+      return;
+    }
+
+    //Grown out of the inode: append all of it to the file as if empty,
+    //the inode on disk stays as it is until that succeeds
+    char* promoted = arena.alloc_array<char>(inode.size + len_data);
+    memcpy(promoted, inode.inline_data, inode.size);
+    memcpy(promoted + inode.size, data, len_data);
+    data = promoted;
+    len_data += inode.size;
+    inode.size = 0;
+    inode.flags &= ~INODE_INLINE;
+    for(int i = 0; i < MAX_DATA_BLOCKS; i++)
+      inode.blocks[i] = 0;
+  }
+
+  if(inode.flags & INODE_COMPRESSED) {
+    append_compressed(inode_num, inode, data, len_data);
+    return;
+  }
+
   //Prepare for appending data
   append_info app;
   app.blk_index = inode.size / BLOCK_SIZE; //Starting block to ins
   int blk_offset = inode.size % BLOCK_SIZE; //Starting ins spot in block
-  app.datablk_nums = new short[(len_data/BLOCK_SIZE)+1]; //Potentially created data block numbers
+  app.datablk_nums = arena.alloc_array<short>((len_data/BLOCK_SIZE)+1); //Potentially created data block numbers
   app.num_datablks = 0; //Tracks the amt of data blocks created, will index into datablk_nums
   app.existing_blk = false; //Tracks if the datablk struct was read from disk
+  app.shared_blk = 0;
+  app.copy_blk = 0;
   int count = 0; //Tracks amt loop iterations and is an index for data
 
   //Append data
@@ -190,7 +301,8 @@ void FileSys::append(const char *name, const char *data)
 
     //Read existing data block if exists
     if(inode.blocks[app.blk_index] != 0 && !app.existing_blk) {
-      bfs.read_block(inode.blocks[app.blk_index], (void*)&app.datablk);
+      if(!checkerr_509(inode.blocks[app.blk_index], (void*)&app.datablk))
+        return;
       app.existing_blk = true;
     } else if(inode.blocks[app.blk_index] == 0) {
       app.existing_blk = false;
@@ -198,7 +310,7 @@ void FileSys::append(const char *name, const char *data)
 
     //Check if data block is full 
     if(blk_offset == BLOCK_SIZE) {
-      if(my_write_block(app, count, len_data, inode.blocks[app.blk_index])) {
+      if(my_write_block(app, inode.blocks[app.blk_index], true)) {
         return;
       }
       blk_offset = 0;
@@ -209,7 +321,7 @@ void FileSys::append(const char *name, const char *data)
     }
   }
   //If a data block never got full completely
-  if(my_write_block(app, count, len_data, inode.blocks[app.blk_index])) {
+  if(my_write_block(app, inode.blocks[app.blk_index], blk_offset == BLOCK_SIZE)) {
     return;
   }
 
@@ -219,11 +331,16 @@ void FileSys::append(const char *name, const char *data)
   int n = 0; //For indexing app.datablk_nums arr
   while(num_inode_blks < loop_count)
     inode.blocks[num_inode_blks++] = app.datablk_nums[n++];
-  delete [] app.datablk_nums;
 
-  //Write to the inode for the file to disk
+  //Write to the inode for the file to disk. It can no longer fail, so
+  //the answer now waits out read leases other clients hold on the file
   inode.size += len_data;
-  bfs.write_block(inode_num, (void*)&inode);
+  revoke_leases(inode_num);
+  write_inode(inode_num, inode);
+
+  //The file no longer uses the shared block it copied
+  if(app.shared_blk)
+    bfs.reclaim_block(app.shared_blk);
   send_msg(200);
 }
 
@@ -234,74 +351,128 @@ void FileSys::cat(const char *name)
 }
 
 // display the first N bytes of the file
+// The body is streamed: the headers go out with the first data block, then
+// each block is written as soon as it is read, so a large cat never builds
+// the file in memory.
 void FileSys::head(const char *name, unsigned int n)
 {
-  string output = "";
-
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void*)&cwdblk);
-
   //Get block number for file and check for errors 501 & 503
+  //Readers share the file, an append waits until they are done
+  BlockLock file_lock(locks, LOCK_SHARED);
   inode_t inode;
-  short inode_num = checkerr_501_503((void*)&cwdblk, (void*)&inode, name);
+  short inode_num = checkerr_501_503((void*)&inode, name, &file_lock);
   if(!inode_num)
     return;
+  send_file(inode_num, inode, n);
+}
 
-  //Calculate amount of iterations
+// sends the first n bytes of the file, the file must be locked
+void FileSys::send_file(short inode_num, inode_t& inode, unsigned int n)
+{
+  //Calculate amount of bytes to send
   unsigned int iter_amt;
   if(n >= inode.size)
     iter_amt = inode.size;
   else
     iter_amt = n;
-  //Index and flag for staying within block bound
-  int blk_index = 0;
-  int blk_offset = 0;
-  bool read_block = false;
+
+  //Hand out a read lease on the file to a caching client
+  if(lease_on) {
+    lease_table.grant(inode_num, session);
+    request_counters.leases++;
+  }
+
+  //Send headers up front, length includes the trailing newline
+  if(!send_header(iter_amt ? iter_amt + 1 : 0, lease_on))
+    return;
+
+  //Small files are sent straight from the inode
+  if(inode.flags & INODE_INLINE) {
+    if(iter_amt && send_bytes(inode.inline_data, iter_amt))
+      send_bytes("\n", 1);
+    return;
+  }
+
+  //Send one block-sized chunk per data block read
   datablock_t datablk;
-  for(unsigned int i = 0; i < iter_amt; i++) {
-    //Read block if at end or very first block
-    if(!read_block) {
-      bfs.read_block(inode.blocks[blk_index], (void*)&datablk);
-      read_block = true;
-    }
-    output += datablk.data[blk_offset++];
-    if(blk_offset == BLOCK_SIZE) {
-      read_block = false;
-      blk_offset = 0;
-      blk_index++;
+  unsigned int bytes_left = iter_amt;
+  int blk_index = 0;
+  int end_blk = inode_numblk(iter_amt);
+  uint64_t disk_reads = request_counters.disk_reads;
+  while(bytes_left > 0) {
+    read_ahead(inode_num, inode, blk_index, end_blk,
+               request_counters.disk_reads != disk_reads);
+    disk_reads = request_counters.disk_reads;
+
+    //Full compressed groups are decompressed whole, only as many as
+    //the requested range needs
+    if(compressed_blks(inode, blk_index)) {
+      char group[GROUP_SIZE];
+      if(!read_group(inode, blk_index, group)) {
+        error = true;
+        return;
+      }
+      unsigned int chunk = bytes_left < GROUP_SIZE ? bytes_left : GROUP_SIZE;
+      bytes_left -= chunk;
+      if(!send_bytes(group, chunk) || (bytes_left && !flush()))
+        return;
+      blk_index += GROUP_BLOCKS;
+      continue;
     }
-    if(i == iter_amt - 1) {
-      output += "\n";
+
+    //The headers are out, a corrupt block can only end the session
+    if(!bfs.read_block(inode.blocks[blk_index++], (void*)&datablk)) {
+      error = true;
+      return;
     }
+    //Each block goes out before the next is read, the last one waits for
+    //the newline
+    unsigned int chunk = bytes_left < BLOCK_SIZE ? bytes_left : BLOCK_SIZE;
+    bytes_left -= chunk;
+    if(!send_bytes(datablk.data, chunk) || (bytes_left && !flush()))
+      return;
   }
-  send_msg(200, output);
+  if(iter_amt)
+    send_bytes("\n", 1);
 }
 
 // delete a data file
 void FileSys::rm(const char *name)
 {
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void*)&cwdblk);
+  //Get curr dir version
+  BlockLock cwd_lock(locks, curr_dir, LOCK_EXCLUSIVE);
+  const DirVersion* cwd = get_dir(curr_dir, true);
+  if(!cwd)
+    return;
   
-  //Get inode block number for file and check for errors 501 & 503
+  //Get inode block number for file and check for errors 501, 503 & 514
+  BlockLock file_lock(locks, LOCK_EXCLUSIVE);
   inode_t inode;
-  short inode_num = checkerr_501_503((void*)&cwdblk, (void*)&inode, name);
-  if(!inode_num)
+  short inode_num = checkerr_501_503((void*)&inode, name, &file_lock);
+  if(!inode_num || !checkerr_514(inode_num))
     return;
 
+  //Check for error 510, its handles would go on reading freed blocks
+  if(inodes.pinned(inode_num)) {
+    send_msg(510);
+    return;
+  }
+
+  //The answer waits out read leases other clients hold on the file
+  revoke_leases(inode_num);
 
-  //Remove file's data blocks
-  unsigned int num_blks = inode_numblk(inode.size);
-  for(unsigned int i = 0; i < num_blks; i++)
-    bfs.reclaim_block(inode.blocks[i]);
+  //Remove file's data blocks, compressed groups leave slots unused
+  unsigned int num_blks = inode.flags & INODE_INLINE ? 0 : inode_numblk(inode.size);
+  for(unsigned int i = 0; i < num_blks; i++) {
+    if(inode.blocks[i])
+      bfs.reclaim_block(inode.blocks[i]);
+  }
 
   //Remove file inode
   bfs.reclaim_block(inode_num);
 
   //Remove entry from curr dir
-  rem_cwd((void*)&cwdblk, inode_num);
+  rem_cwd(cwd, inode_num);
 
   send_msg(200);
 }
@@ -309,33 +480,566 @@ void FileSys::rm(const char *name)
 // display stats about file or directory
 void FileSys::stat(const char *name)
 {
-  string output = "";
+  const int STAT_SIZE = 256; //fits the longest name and every field
+  char* output = arena.alloc_array<char>(STAT_SIZE);
+  int len;
+
+  //Get curr dir version, looked up without locks
+  DirCache::Reader reader;
+  const DirVersion* cwd = get_dir(curr_dir);
+  short blk_num = 0;
+  bool subdir = false;
+  inode_t inode;
+  while(cwd) {
+    //Get block for requested file and check for error 503
+    blk_num = file_exists(cwd, name, &subdir);
+    if(!blk_num) {
+      send_msg(503);
+      return;
+    }
+    if(subdir)
+      break;
+
+    //Read the inode, it was only still the file's if the cwd is unchanged
+    if(!checkerr_509(blk_num, (void *) &inode))
+      return;
+    const DirVersion* now = dirs.get(curr_dir);
+    if(now == cwd)
+      break;
+    cwd = now ? now : get_dir(curr_dir);
+  }
+  if(!cwd)
+    return;
+
+  if(subdir) {
+    len = snprintf(output, STAT_SIZE, "Directory name: %s/\nDirectory block: %d", name, blk_num);
+  } else {
+    bool is_inline = inode.flags & INODE_INLINE;
+    unsigned int num_blks = 1; //the inode and the data blocks in use
+    for(unsigned int i = 0; !is_inline && i < inode_numblk(inode.size); i++)
+      num_blks += inode.blocks[i] != 0;
+    len = snprintf(output, STAT_SIZE, "Inode block: %d\nBytes in file: %u\nNumber of blocks: %u\nFirst block: %d",
+                   blk_num, (unsigned int) inode.size, num_blks, is_inline ? 0 : inode.blocks[0]);
+  }
+
+  //Hand out a read lease on the file to a caching client
+  if(lease_on) {
+    lease_table.grant(blk_num, session);
+    request_counters.leases++;
+  }
+  if(send_header(len, lease_on))
+    send_bytes(output, len);
+}
+
+// open a data file, answering with a handle for read() and write()
+// The file cannot be removed until the handle is closed
+void FileSys::open(const char *name)
+{
+  //Get inode and block number for file and check for errors 501 & 503
+  //The file stays locked until it is pinned, so rm cannot remove it first
+  BlockLock file_lock(locks, LOCK_SHARED);
+  inode_t inode;
+  short inode_num = checkerr_501_503((void*)&inode, name, &file_lock);
+  if(!inode_num)
+    return;
+
+  //Check for error 511
+  int fd = 0;
+  while(fd < MAX_HANDLES && handles[fd])
+    fd++;
+  if(fd == MAX_HANDLES) {
+    send_msg(511);
+    return;
+  }
+
+  //Keep the inode in memory while the handle is open
+  inodes.pin(inode_num, &inode);
+  handles[fd] = inode_num;
+  char msg[16];
+  int len = snprintf(msg, sizeof(msg), "%d", fd);
+  send_msg(200, msg, len);
+}
+
+// close a handle returned by open()
+void FileSys::close(int fd)
+{
+  short inode_num = checkerr_512(fd);
+  if(!inode_num)
+    return;
+  inodes.unpin(inode_num);
+  handles[fd] = 0;
+  send_msg(200);
+}
+
+// display the first N bytes of an open file
+// The handle goes straight to the inode in memory, no directory lookup
+// and no inode block read
+void FileSys::read(int fd, unsigned int n)
+{
+  short inode_num = checkerr_512(fd);
+  if(!inode_num)
+    return;
+  BlockLock file_lock(locks, inode_num, LOCK_SHARED);
+  inode_t inode;
+  inodes.read(inode_num, &inode);
+  send_file(inode_num, inode, n);
+}
+
+// append data to an open file
+void FileSys::write(int fd, const char *data)
+{
+  short inode_num = checkerr_512(fd);
+  if(!inode_num)
+    return;
+  BlockLock file_lock(locks, inode_num, LOCK_EXCLUSIVE);
+  inode_t inode;
+  inodes.read(inode_num, &inode);
+  append_file(inode_num, inode, data);
+}
+
+// delete a directory with everything in it, or a data file
+// Nothing is deleted if anything in it is in use
+void FileSys::rm_tree(const char *name)
+{
+  //Get curr dir version
+  BlockLock cwd_lock(locks, curr_dir, LOCK_EXCLUSIVE);
+  const DirVersion* cwd = get_dir(curr_dir, true);
+  if(!cwd)
+    return;
+
+  //Get block number for the file or directory and check for error 503
+  bool subdir = false;
+  short blk_num = file_exists(cwd, name, &subdir);
+  if(!blk_num) {
+    send_msg(503);
+    return;
+  }
 
-  //Get curr dir blk
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void*)&cwdblk);
+  //Check for error 514, a snapshot can only go as a whole from the
+  //snapshot directory
+  short snap_dir = 0;
+  if(bfs.read_only(curr_dir)) {
+    DirCache::Reader reader;
+    const DirVersion* root = get_dir(1);
+    if(!root)
+      return;
+    snap_dir = file_exists(root, SNAPSHOT_DIR);
+  }
+  if(curr_dir != snap_dir && !checkerr_514(blk_num))
+    return;
+
+  //Read the subtree on every CPU first, the locked walk below then finds
+  //it in the caches
+  if(subdir) {
+    tree_usage usage;
+    scan_tree_parallel(blk_num, curr_dir, usage);
+  }
+
+  //Lock all of it and check for errors 509 & 510 before anything is
+  //removed, the blocks are only collected on the way
+  BlockLockSet held(locks, LOCK_EXCLUSIVE);
+  vector<short> blks, dir_blks;
+  int err = lock_tree(blk_num, subdir, held, blks, dir_blks);
+  if(err) {
+    send_msg(err);
+    return;
+  }
 
-  //Get block for requested file and check for error 503
-  short blk_num = file_exists((void*)&cwdblk, name);  
+  //Revoke read leases, then free every block at once. Nothing under
+  //the entry is written, it is gone once the cwd no longer lists it
+  for(size_t i = 0; i < blks.size(); i++)
+    revoke_leases(blks[i]);
+  for(size_t i = 0; i < dir_blks.size(); i++)
+    dirs.drop(dir_blks[i]);
+  bfs.reclaim_blocks(blks.data(), blks.size());
+
+  //Remove entry from curr dir
+  rem_cwd(cwd, blk_num);
+
+  send_msg(200);
+}
+
+// copy a data file to a new entry of the current directory, sharing
+// its data blocks until either file is written
+void FileSys::cp(const char *src, const char *dst)
+{
+  copy_entry(src, dst, false);
+}
+
+// copy a directory with everything in it, or a data file, to a new
+// entry of the current directory
+void FileSys::cp_tree(const char *src, const char *dst)
+{
+  copy_entry(src, dst, true);
+}
+
+// Copies entry src of the cwd to new entry dst, with everything under
+// it if it is a directory and recursive is set
+void FileSys::copy_entry(const char *src, const char *dst, bool recursive)
+{
+  size_t len_name = strlen(dst);
+  BlockLock cwd_lock(locks, curr_dir, LOCK_EXCLUSIVE);
+  if(!checkerr_514(curr_dir))
+    return;
+  const DirVersion* cwd = get_dir(curr_dir, true);
+  if(!cwd)
+    return;
+
+  //Check for errors 503, 501, 504, 516, 502 & 506 before copying anything
+  bool subdir = false;
+  short blk_num = file_exists(cwd, src, &subdir);
   if(!blk_num) {
     send_msg(503);
     return;
   }
+  if(subdir && !recursive) {
+    send_msg(501);
+    return;
+  }
+  if(len_name > MAX_FNAME_SIZE) {
+    send_msg(504);
+    return;
+  }
+  if(!checkerr_516(curr_dir, dst))
+    return;
+  if(file_exists(cwd, dst)) {
+    send_msg(502);
+    return;
+  }
+  if(cwd->block.num_entries == MAX_DIR_ENTRIES) {
+    send_msg(506);
+    return;
+  }
+
+  //Read the subtree on every CPU first, the locked copy below then finds
+  //it in the caches
+  if(subdir) {
+    tree_usage usage;
+    scan_tree_parallel(blk_num, curr_dir, usage);
+  }
+
+  //Nothing changes the original while it is copied
+  BlockLockSet held(locks, LOCK_SHARED);
+  vector<short> new_blks;
+  int err = 0;
+  short copy = copy_tree(blk_num, subdir, held, new_blks, err);
+  if(!copy) {
+    bfs.reclaim_blocks(new_blks.data(), new_blks.size());
+    send_msg(err);
+    return;
+  }
+
+  //Add the copy to the curr dir, which cannot fail after the checks above
+  if(add_cwd(copy, dst, subdir))
+    send_msg(200);
+}
+
+// rename an entry of the current directory, or move it into the
+// directory at path dst, relative to the current one or from the root
+// if it starts with /. An existing directory at dst gets the entry
+// under its old name
+void FileSys::mv(const char *src, const char *dst)
+{
+  //One move at a time, so no directory moves while the target is looked up
+  lock_guard<mutex> move_guard(locks.moves);
+  DirCache::Reader reader;
+
+  //The part of dst after the last / is the new name, or a directory to
+  //move the entry into
+  string path(dst);
+  size_t slash = path.rfind('/');
+  string name = slash == string::npos ? path : path.substr(slash + 1);
+  path = slash == string::npos ? "" : path.substr(0, slash + 1);
+  vector<short> visited;
+  short dir_num, parent;
+  const DirVersion* dir = lookup_path(path, dir_num, parent, visited);
+  if(!dir)
+    return;
+  bool subdir = false;
+  short target = name.empty() ? 0 : file_exists(dir, name.c_str(), &subdir);
+  if(name.empty() || (target && subdir)) {
+    if(target) {
+      parent = dir_num;
+      dir_num = target;
+      visited.push_back(target);
+    }
+    name = src;
+  }
+  if(name.size() > MAX_FNAME_SIZE) {
+    send_msg(504);
+    return;
+  }
+
+  //Lock the cwd and the target directory, never waiting for one while
+  //holding the other since either may be above the other
+  BlockLock cwd_lock(locks, LOCK_EXCLUSIVE);
+  BlockLock dir_lock(locks, LOCK_EXCLUSIVE);
+  while(true) {
+    cwd_lock.lock(curr_dir);
+    if(dir_num == curr_dir || dir_lock.try_lock(dir_num))
+      break;
+    cwd_lock.unlock();
+    dir_lock.lock(dir_num);
+    if(cwd_lock.try_lock(curr_dir))
+      break;
+    dir_lock.unlock();
+  }
+
+  //The target may have been removed before it was locked
+  if(parent && !listed(parent, dir_num)) {
+    send_msg(503);
+    return;
+  }
+
+  //Get the entry and check for errors 503, 514 & 513
+  const DirVersion* cwd = get_dir(curr_dir, true);
+  if(!cwd)
+    return;
+  short blk_num = file_exists(cwd, src, &subdir);
+  if(!blk_num) {
+    send_msg(503);
+    return;
+  }
+  if(!checkerr_514(blk_num) || !checkerr_514(curr_dir) || !checkerr_514(dir_num))
+    return;
+  if(subdir && find(visited.begin(), visited.end(), blk_num) != visited.end()) {
+    send_msg(513);
+    return;
+  }
+  if(dir_num == curr_dir && name == src) {
+    send_msg(200);
+    return;
+  }
+
+  //Check for errors 516, 502 & 506 in the target
+  if(!checkerr_516(dir_num, name.c_str()))
+    return;
+  const DirVersion* to = dir_num == curr_dir ? cwd : get_dir(dir_num, true);
+  if(!to)
+    return;
+  if(file_exists(to, name.c_str())) {
+    send_msg(502);
+    return;
+  }
+  if(to != cwd && to->block.num_entries == MAX_DIR_ENTRIES) {
+    send_msg(506);
+    return;
+  }
+
+  //Cached results under the old path go
+  revoke_leases(blk_num);
+
+  //A rename only rewrites the entry
+  if(to == cwd) {
+    DirVersion* version = new DirVersion(*cwd);
+    for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+      if(version->block.dir_entries[i].block_num == blk_num)
+        strcpy(version->block.dir_entries[i].name, name.c_str());
+    }
+    bfs.write_block(curr_dir, (void*)&version->block);
+    dirs.publish(curr_dir, version);
+    send_msg(200);
+    return;
+  }
+
+  //A move adds the entry to the target and takes it out of the cwd, both
+  //in the same commit
+  DirVersion* version = new DirVersion(*to);
+  int i = 0;
+  while(version->block.dir_entries[i].block_num != 0)
+    i++;
+  strcpy(version->block.dir_entries[i].name, name.c_str());
+  version->block.dir_entries[i].block_num = blk_num;
+  version->block.num_entries++;
+  version->subdir[i] = subdir;
+  bfs.write_block(dir_num, (void*)&version->block);
+  dirs.publish(dir_num, version);
+  rem_cwd(cwd, blk_num);
+
+  send_msg(200);
+}
+
+// display the directories, files, bytes and blocks under a directory,
+// the current one if name is NULL, or of a data file
+void FileSys::du(const char *name)
+{
+  const int DU_SIZE = 128; //fits every field
+  char* output = arena.alloc_array<char>(DU_SIZE);
+
+  //Get curr dir version, looked up without locks
+  DirCache::Reader reader;
+  const DirVersion* cwd = get_dir(curr_dir);
+  if(!cwd)
+    return;
+
+  //The session keeps its cwd, only a named entry can go away meanwhile
+  tree_usage usage;
+  int err;
+  if(!name) {
+    err = scan_tree_parallel(curr_dir, 0, usage);
+  } else {
+    bool subdir = false;
+    short blk_num = file_exists(cwd, name, &subdir);
+    if(!blk_num) {
+      send_msg(503);
+      return;
+    }
+    if(subdir)
+      err = scan_tree_parallel(blk_num, curr_dir, usage);
+    else
+      err = scan_tree(blk_num, false, curr_dir, usage);
+  }
+  if(err) {
+    send_msg(err);
+    return;
+  }
+
+  int len = snprintf(output, DU_SIZE, "Directories: %u\nFiles: %u\nBytes in files: %llu\nNumber of blocks: %u",
+                     usage.dirs, usage.files, usage.bytes, usage.blocks);
+  send_msg(200, output, len);
+}
+
+// freeze the whole tree as a read-only snapshot called name in the
+// snapshot directory of the root, sharing the data blocks with the
+// live files
+void FileSys::snapshot(const char *name)
+{
+  size_t len_name = strlen(name);
+  if(len_name > MAX_FNAME_SIZE) {
+    send_msg(504);
+    return;
+  }
 
-  //Read block for file
-  dirblock_t entryblk;
-  bfs.read_block(blk_num, (void *) &entryblk);
+  //The root stays locked so the snapshot directory can be added to it
+  BlockLock root_lock(locks, 1, LOCK_EXCLUSIVE);
+  const DirVersion* root = get_dir(1, true);
+  if(!root)
+    return;
 
-  if(is_dir((void*)&entryblk)) {
-    output = "Directory name: " + string(name) + "/\nDirectory block: " + to_string(blk_num);
+  //Get the snapshot directory and check for errors 516, 502 & 506. Only
+  //the frozen directory made here is taken as it, an entry that got the
+  //name some other way is not
+  bool subdir = false;
+  short snap_dir = file_exists(root, SNAPSHOT_DIR, &subdir);
+  if(snap_dir && (!subdir || !bfs.read_only(snap_dir))) {
+    send_msg(516);
+    return;
+  }
+  BlockLock snap_lock(locks, LOCK_EXCLUSIVE);
+  if(snap_dir) {
+    snap_lock.lock(snap_dir);
+    const DirVersion* snaps = get_dir(snap_dir, true);
+    if(!snaps)
+      return;
+    if(file_exists(snaps, name)) {
+      send_msg(502);
+      return;
+    }
+    if(snaps->block.num_entries == MAX_DIR_ENTRIES) {
+      send_msg(506);
+      return;
+    }
   } else {
-    inode_t inode = *((inode_t*)((void*)&entryblk));
-    output = "Inode block: " + to_string(blk_num);
-    output += "\nBytes in file: " + to_string(inode.size);
-    output += "\nNumber of blocks: " + to_string(inode_numblk(inode.size)+1);
-    output += "\nFirst block: " + to_string(inode.blocks[0]);
+    //The first snapshot makes it, nothing can look it up before add_entry
+    size_t len_snap = strlen(SNAPSHOT_DIR);
+    snap_dir = checkerr_504_505(len_snap);
+    if(!snap_dir)
+      return;
+    snap_lock.lock(snap_dir);
+    DirVersion* version = new DirVersion;
+    version->block.magic = DIR_MAGIC_NUM;
+    version->block.num_entries = 0;
+    for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+      version->block.dir_entries[i].block_num = 0;
+      version->subdir[i] = false;
+    }
+    bfs.write_block(snap_dir, (void*)&version->block);
+    bfs.set_read_only(snap_dir);
+    if(!add_entry(1, snap_dir, SNAPSHOT_DIR, true)) {
+      delete version;
+      return;
+    }
+    dirs.publish(snap_dir, version);
+    root = get_dir(1, true);
+    if(!root)
+      return;
+  }
+
+  //Copy every entry of the root but the snapshots. Each block is locked
+  //shared before it is copied and stays locked until the end, so the copy
+  //is of one point in time. Writers wait only while the directories and
+  //inodes are copied, the data blocks are shared
+  dirblock_t dblk = root->block;
+  BlockLockSet held(locks, LOCK_SHARED);
+  vector<short> new_blks;
+  int err = 0;
+  for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+    short entry = dblk.dir_entries[i].block_num;
+    if(!entry)
+      continue;
+    if(entry == snap_dir) {
+      dblk.dir_entries[i].block_num = 0;
+      dblk.dir_entries[i].name[0] = '\0';
+      dblk.num_entries--;
+      continue;
+    }
+    dblk.dir_entries[i].block_num = copy_tree(entry, root->subdir[i], held, new_blks, err, true);
+    if(!dblk.dir_entries[i].block_num)
+      break;
+  }
+  short copy = err ? 0 : bfs.get_free_block();
+  if(!copy) {
+    bfs.reclaim_blocks(new_blks.data(), new_blks.size());
+    send_msg(err ? err : 505);
+    return;
+  }
+  bfs.write_block(copy, (void*)&dblk);
+  bfs.set_read_only(copy);
+
+  //Add the snapshot, which cannot fail after the checks above
+  if(add_entry(snap_dir, copy, name, true))
+    send_msg(200);
+}
+
+// grant read leases on cat/head/stat responses for a caching client
+void FileSys::lease() {
+  lease_on = true;
+  send_msg(200);
+}
+
+// store the data of files created from now on compressed
+void FileSys::set_compression(bool on) {
+  compress_files = on;
+}
+
+// share full data blocks with the same contents as one already on disk
+void FileSys::set_dedup(bool on) {
+  dedup_blocks = on;
+}
+
+// display the server's per-operation counters and latencies
+void FileSys::stats() {
+  string report = server_stats.report();
+  send_msg(200, report.c_str(), report.length());
+}
+
+// answer a command line that lacks an argument the command needs
+void FileSys::missing_arg() {
+  send_msg(515);
+}
+
+// turn tracing on or off, or with "dump" send the trace as Chrome trace JSON
+void FileSys::trace(const char *arg) {
+  if(!strcmp(arg, "on")) {
+    trace_enable(true);
+    send_msg(200);
+  } else if(!strcmp(arg, "off")) {
+    trace_enable(false);
+    send_msg(200);
+  } else {
+    string trace = trace_export();
+    send_msg(200, trace.c_str(), trace.length());
   }
-  send_msg(200, output);
 }
 
 // HELPER FUNCTIONS (optional)
@@ -346,14 +1050,17 @@ bool FileSys::is_dir(void* block) {
   return dblk.magic == DIR_MAGIC_NUM;
 }
 
-// if file DNE returns -1, else returns the block number of the file.
-short FileSys::file_exists(void* block, const char *name) {
-  dirblock_t dblk = *(dirblock_t*) block;
+// if file DNE returns 0, else returns the block number of the file.
+// Sets subdir to whether the entry is a directory if given
+short FileSys::file_exists(const DirVersion* dir, const char *name, bool* subdir) {
+  const dirblock_t& dblk = dir->block;
   int i = 0;
   int loop_amt = dblk.num_entries;
   while(i < loop_amt) {
     if(dblk.dir_entries[i].block_num > 0) {
       if(!strcmp(dblk.dir_entries[i].name, name)) {
+        if(subdir)
+          *subdir = dir->subdir[i];
         return dblk.dir_entries[i].block_num;
       }
     } else {
@@ -366,53 +1073,74 @@ short FileSys::file_exists(void* block, const char *name) {
 }
 
 // simple formula that returns the number of data blocks in an inode
-unsigned int FileSys::inode_numblk(unsigned int& size) {
+unsigned int FileSys::inode_numblk(unsigned int size) {
   unsigned int num_blks = size / BLOCK_SIZE;
   if(size % BLOCK_SIZE > 0)
     num_blks++;
   return num_blks;
 }
 
-// Checks if file exists and if the file is a directory
-// Basically combines is_dir and file_exists
+// Checks if file exists in dir and if the file is a directory
 // Sends error corresponding error messages using send_msg()
-// Reads the block into dblk parameter if file exists
+// Locks the block with lock if one is given
 // Returns dir block number if file exists
-short FileSys::checkerr_500_503(void* block, void* dblk, const char *name) {
-  //Get dir block number from cwd block
-  short blk_num = file_exists(block, name);
+short FileSys::checkerr_500_503(const DirVersion* dir, const char *name, BlockLock* lock) {
+  //Get dir block number from the dir version
+  bool subdir = false;
+  short blk_num = file_exists(dir, name, &subdir);
   
   if(!blk_num) {
     send_msg(503);
     return 0;
   }
-  bfs.read_block(blk_num, dblk);
-  if(!is_dir(dblk)) {
+  if(!subdir) {
     send_msg(500);
     return 0;
   }
+  if(lock)
+    lock->lock(blk_num);
   return blk_num;
 }
 
-// Basically the same as checkerr_500_503
+// Basically the same as checkerr_500_503, looking in the cwd
 // Checks if file exists and if the file is a file
 // Sends error corresponding error messages using send_msg()
 // Reads the block into inode parameter if file exists
+// Locks the block with lock first if one is given, and looks the file
+// up again if the cwd changed before it was locked
 // Returns inode block number if the file exists
-short FileSys::checkerr_501_503(void* block, void* inodeblk, const char *name) {
-  //Get file block number from cwd block
-  short blk_num = file_exists(block, name); 
-  
-  if(!blk_num) {
-    send_msg(503);
-    return 0;
-  }
-  bfs.read_block(blk_num, inodeblk);
-  if(is_dir(inodeblk)) {
-    send_msg(501);
-    return 0;
+short FileSys::checkerr_501_503(void* inodeblk, const char *name, BlockLock* lock) {
+  DirCache::Reader reader;
+  const DirVersion* cwd = get_dir(curr_dir);
+  while(cwd) {
+    //Get file block number from cwd version
+    bool subdir = false;
+    short blk_num = file_exists(cwd, name, &subdir);
+
+    if(!blk_num) {
+      send_msg(503);
+      return 0;
+    }
+    if(subdir) {
+      send_msg(501);
+      return 0;
+    }
+    if(lock) {
+      //The file may have been removed before it was locked, it is only
+      //still there if the cwd is unchanged
+      lock->lock(blk_num);
+      const DirVersion* now = dirs.get(curr_dir);
+      if(now != cwd) {
+        lock->unlock();
+        cwd = now ? now : get_dir(curr_dir);
+        continue;
+      }
+    }
+    if(!checkerr_509(blk_num, inodeblk))
+      return 0;
+    return blk_num;
   }
-  return blk_num;
+  return 0;
 }
 
 // Checks if fname is valid and disk is not full
@@ -432,14 +1160,90 @@ short FileSys::checkerr_504_505(size_t& len_name) {
   return blk_num;
 }
 
+// Reads block blk_num into block
+// Sends error 509 using send_msg() if it does not match its checksum
+// Returns - true on success
+bool FileSys::checkerr_509(short blk_num, void* block) {
+  if(!bfs.read_block(blk_num, block)) {
+    send_msg(509);
+    return false;
+  }
+  return true;
+}
+
+// Returns the inode block number of open handle fd
+// Sends error 512 using send_msg() and returns 0 if fd is not open
+short FileSys::checkerr_512(int fd) {
+  if(fd < 0 || fd >= MAX_HANDLES || !handles[fd]) {
+    send_msg(512);
+    return 0;
+  }
+  return handles[fd];
+}
+
+// Revokes the read leases on blk_num before it changes, the answer is
+// held back until the leases of other sessions have run out
+void FileSys::revoke_leases(short blk_num) {
+  LeaseTable::clock::time_point expiry = lease_table.revoke(blk_num, session);
+  if(expiry > lease_wait)
+    lease_wait = expiry;
+}
+
+// Checks that blk_num is not part of a snapshot
+// Sends error 514 using send_msg() if it is
+// Returns - true if blk_num can be changed
+bool FileSys::checkerr_514(short blk_num) {
+  if(bfs.read_only(blk_num)) {
+    send_msg(514);
+    return false;
+  }
+  return true;
+}
+
+// Checks that name is free to use in directory dir_num, the root keeps
+// SNAPSHOT_DIR for the snapshots
+// Sends error 516 using send_msg() if it is not
+// Returns - true if name can be given to a new entry
+bool FileSys::checkerr_516(short dir_num, const char *name) {
+  if(dir_num == 1 && !strncmp(name, SNAPSHOT_DIR, MAX_FNAME_SIZE + 1)) {
+    send_msg(516);
+    return false;
+  }
+  return true;
+}
+
+// Makes blk_num the cwd, the session uses it until it moves on
+// The directory must be locked, or be the root
+void FileSys::set_cwd(short blk_num) {
+  inodes.pin(blk_num);
+  inodes.unpin(curr_dir);
+  curr_dir = blk_num;
+}
+
+// writes inode to its block, and to the inode table if the file is open
+void FileSys::write_inode(short inode_num, inode_t& inode) {
+  bfs.write_block(inode_num, (void*)&inode);
+  inodes.update(inode_num, inode);
+}
+
 // Gets cwd dir block
 // Updates the curr dir by adding the new dir entry to an empty spot
 // Returns - true on success
-bool FileSys::add_cwd(short blk_num, const char *name, size_t &len_name) {
+bool FileSys::add_cwd(short blk_num, const char *name, bool subdir) {
+  return add_entry(curr_dir, blk_num, name, subdir);
+}
 
-  //Read curr dir block 
-  dirblock_t cwdblk;
-  bfs.read_block(curr_dir, (void *) &cwdblk);
+// Same as add_cwd() for directory dir_num, which must be locked
+// exclusively
+bool FileSys::add_entry(short dir_num, short blk_num, const char *name, bool subdir) {
+
+  //Get dir version, unchanging while the dir is locked
+  const DirVersion* cwd = get_dir(dir_num, true);
+  if(!cwd) {
+    bfs.reclaim_block(blk_num);
+    return false;
+  }
+  const dirblock_t& cwdblk = cwd->block;
 
   if(cwdblk.num_entries == MAX_DIR_ENTRIES) { //Check if dir is full
     bfs.reclaim_block(blk_num);
@@ -447,31 +1251,39 @@ bool FileSys::add_cwd(short blk_num, const char *name, size_t &len_name) {
     return false;
   }
 
-  //Seek for an open entry spot
-  int i = 0;
-  while(i < MAX_DIR_ENTRIES && cwdblk.dir_entries[i].block_num != 0 ) {
-    if(!strcmp(cwdblk.dir_entries[i].name, name)) { //Check if file already exists
+  //Seek for an open entry spot, checking every entry since removed
+  //files leave holes before later ones
+  int i = MAX_DIR_ENTRIES;
+  for(int j = 0; j < MAX_DIR_ENTRIES; j++) {
+    if(cwdblk.dir_entries[j].block_num == 0) {
+      if(i == MAX_DIR_ENTRIES)
+        i = j;
+    } else if(!strcmp(cwdblk.dir_entries[j].name, name)) { //Check if file already exists
       bfs.reclaim_block(blk_num);
       send_msg(502);
       return false;
     }
-    i++;
   }
 
-  //Initialize dir entry values
-  strcpy(cwdblk.dir_entries[i].name, name);
-  cwdblk.dir_entries[i].block_num = blk_num;
-  cwdblk.num_entries++;
+  //Initialize dir entry values in a new version
+  DirVersion* version = new DirVersion(*cwd);
+  strcpy(version->block.dir_entries[i].name, name);
+  version->block.dir_entries[i].block_num = blk_num;
+  version->block.num_entries++;
+  version->subdir[i] = subdir;
 
-  //Write to disk
-  bfs.write_block(curr_dir, (void*)&cwdblk);
+  //Write to disk, then let readers see it
+  bfs.write_block(dir_num, (void*)&version->block);
+  dirs.publish(dir_num, version);
 
   return true;
 }
 
-//Given the dir block for the cwd, removes the dir entry for file
-void FileSys::rem_cwd(void* blk, short blk_num) {
-  dirblock_t cwdblk = *(dirblock_t*) blk;
+//Given the version of the cwd, removes the dir entry for file and
+//publishes the new version
+void FileSys::rem_cwd(const DirVersion* cwd, short blk_num) {
+  DirVersion* version = new DirVersion(*cwd);
+  dirblock_t& cwdblk = version->block;
 
   int i = 0;
   while(i < MAX_DIR_ENTRIES && cwdblk.dir_entries[i].block_num != blk_num)
@@ -479,82 +1291,685 @@ void FileSys::rem_cwd(void* blk, short blk_num) {
   cwdblk.num_entries--;
   cwdblk.dir_entries[i].block_num = 0;
   cwdblk.dir_entries[i].name[0] = '\0';
+  version->subdir[i] = false;
 
-  //Write to disk
+  //Write to disk, then let readers see it
   bfs.write_block(curr_dir, (void*)&cwdblk);
+  dirs.publish(curr_dir, version);
+}
+
+// Returns the current version of directory blk_num, reading it into
+// the directory cache first if it is not cached yet. The read takes the
+// directory's shared lock unless locked says the caller holds its lock.
+// Sends error 500 or 509 using send_msg() and returns NULL on failure
+const DirVersion* FileSys::get_dir(short blk_num, bool locked) {
+  int err = 0;
+  const DirVersion* dir = load_dir(blk_num, locked, err);
+  if(!dir)
+    send_msg(err);
+  return dir;
+}
+
+// Same as get_dir(), but safe on any thread: sets err to the error code
+// instead of sending it. If parent is given, blk_num was an entry of
+// that directory, and err is 503 if it is gone by the time blk_num is
+// locked.
+const DirVersion* FileSys::load_dir(short blk_num, bool locked, int& err, short parent) {
+  const DirVersion* dir = dirs.get(blk_num);
+  if(dir)
+    return dir;
+
+  //The lock keeps changes from being published during the read
+  TraceScope trace("dir_fill", blk_num);
+  BlockLock dir_lock(locks, LOCK_SHARED);
+  if(!locked)
+    dir_lock.lock(blk_num);
+
+  //A removed directory must not be cached, it is only still there if
+  //its parent lists it
+  if(parent && !listed(parent, blk_num)) {
+    err = 503;
+    return NULL;
+  }
+  DirVersion* version = new DirVersion;
+  if(!bfs.read_block(blk_num, (void*)&version->block)) {
+    delete version;
+    err = 509;
+    return NULL;
+  }
+  if(!is_dir((void*)&version->block)) {
+    delete version;
+    err = 500;
+    return NULL;
+  }
+
+  //Read each entry once to know which are directories
+  for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+    short entry = version->block.dir_entries[i].block_num;
+    version->subdir[i] = false;
+    if(!entry)
+      continue;
+    dirblock_t entryblk;
+    if(!bfs.read_block(entry, (void*)&entryblk)) {
+      delete version;
+      err = 509;
+      return NULL;
+    }
+    version->subdir[i] = is_dir((void*)&entryblk);
+  }
+  return dirs.fill(blk_num, version);
+}
+
+// Adds the file or directory blk_num, an entry of directory parent, to
+// usage. Each block is locked shared only while
+// it is read, and entries removed meanwhile are left out, so any thread
+// can scan. Callers hold a DirCache::Reader.
+// Returns 0, 503 if blk_num itself is gone, or the error that stopped it
+int FileSys::scan_tree(short blk_num, bool subdir, short parent, tree_usage& usage) {
+  if(!subdir) {
+    //The inode is only still the file's if the directory lists it
+    BlockLock file_lock(locks, blk_num, LOCK_SHARED);
+    if(!listed(parent, blk_num))
+      return 503;
+    inode_t inode;
+    if(!bfs.read_block(blk_num, (void*)&inode))
+      return 509;
+    usage.files++;
+    usage.bytes += inode.size;
+    usage.blocks++;
+    for(unsigned int i = 0; !(inode.flags & INODE_INLINE) && i < inode_numblk(inode.size); i++)
+      usage.blocks += inode.blocks[i] != 0;
+    return 0;
+  }
+
+  int err = 0;
+  const DirVersion* dir = load_dir(blk_num, false, err, parent);
+  if(!dir)
+    return err;
+  usage.dirs++;
+  usage.blocks++;
+  for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+    short entry = dir->block.dir_entries[i].block_num;
+    if(!entry)
+      continue;
+    err = scan_tree(entry, dir->subdir[i], blk_num, usage);
+    if(err && err != 503)
+      return err;
+  }
+  return 0;
+}
+
+// Looks up the directory path leads to, relative to the cwd or from the
+// root if it starts with /, without locks. Sets dir_num to it and
+// parent to its parent, 0 if it is where the path starts, and adds
+// every directory on the way to visited. Callers hold a
+// DirCache::Reader.
+// Sends error 500 or 503 using send_msg() and returns NULL on failure
+const DirVersion* FileSys::lookup_path(const string& path, short& dir_num, short& parent,
+                                       vector<short>& visited) {
+  dir_num = !path.empty() && path[0] == '/' ? 1 : curr_dir;
+  parent = 0;
+  const DirVersion* dir = get_dir(dir_num);
+  size_t pos = 0;
+  while(dir) {
+    //Each part of the path names a directory in the one before
+    while(pos < path.size() && path[pos] == '/')
+      pos++;
+    if(pos == path.size())
+      return dir;
+    size_t end = path.find('/', pos);
+    if(end == string::npos)
+      end = path.size();
+    string name = path.substr(pos, end - pos);
+    pos = end;
+
+    bool subdir = false;
+    short next = file_exists(dir, name.c_str(), &subdir);
+    if(!next) {
+      send_msg(503);
+      return NULL;
+    }
+    if(!subdir) {
+      send_msg(500);
+      return NULL;
+    }
+    int err = 0;
+    dir = load_dir(next, false, err, dir_num);
+    if(!dir) {
+      send_msg(err);
+      return NULL;
+    }
+    parent = dir_num;
+    dir_num = next;
+    visited.push_back(next);
+  }
+  return NULL;
+}
+
+// true if the current version of directory parent lists blk_num
+bool FileSys::listed(short parent, short blk_num) {
+  const DirVersion* dir = dirs.get(parent);
+  for(int i = 0; dir && i < MAX_DIR_ENTRIES; i++) {
+    if(dir->block.dir_entries[i].block_num == blk_num)
+      return true;
+  }
+  return false;
 }
 
-bool FileSys::my_write_block(append_info& app, int& count, int& len_data, short& existblk_num) {
+// Same as scan_tree() for directory blk_num, with its subdirectories
+// scanned by one worker thread per CPU
+int FileSys::scan_tree_parallel(short blk_num, short parent, tree_usage& usage) {
+  TraceScope trace("scan_tree", blk_num);
+  DirCache::Reader reader;
+  int err = 0;
+  const DirVersion* dir = load_dir(blk_num, false, err, parent);
+  if(!dir)
+    return err;
+  usage.dirs++;
+  usage.blocks++;
+
+  //Files are added up right away, each subdirectory is one unit of work
+  vector<short> top;
+  for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+    short entry = dir->block.dir_entries[i].block_num;
+    if(!entry)
+      continue;
+    if(dir->subdir[i]) {
+      top.push_back(entry);
+      continue;
+    }
+    err = scan_tree(entry, false, blk_num, usage);
+    if(err && err != 503)
+      return err;
+  }
+
+  size_t num_threads = min((size_t) max(thread::hardware_concurrency(), 1u), top.size());
+  vector<tree_usage> parts(num_threads);
+  vector<int> errs(num_threads, 0);
+  vector<RequestCounters> counters(num_threads);
+  atomic<size_t> next(0);
+  auto work = [&](size_t t) {
+    DirCache::Reader worker_reader;
+    size_t i;
+    while(!errs[t] && (i = next++) < top.size()) {
+      int e = scan_tree(top[i], true, blk_num, parts[t]);
+      if(e != 503)
+        errs[t] = e;
+    }
+  };
+
+  //A single CPU scans on the session's thread
+  if(num_threads == 1) {
+    work(0);
+  } else {
+    vector<thread> workers;
+    for(size_t t = 0; t < num_threads; t++) {
+      workers.push_back(thread([&, t]() {
+        work(t);
+        counters[t] = request_counters;
+      }));
+    }
+    for(size_t t = 0; t < workers.size(); t++)
+      workers[t].join();
+  }
+
+  //The workers' reads count toward the request
+  for(size_t t = 0; t < num_threads; t++) {
+    usage.dirs += parts[t].dirs;
+    usage.files += parts[t].files;
+    usage.bytes += parts[t].bytes;
+    usage.blocks += parts[t].blocks;
+    request_counters.block_reads += counters[t].block_reads;
+    request_counters.disk_reads += counters[t].disk_reads;
+    if(!err)
+      err = errs[t];
+  }
+  return err;
+}
+
+// Locks the file or directory blk_num and everything under it from the
+// top down in held, and adds their blocks to blks and the directories
+// to dir_blks
+// Returns 0, 510 if any of it is in use, or the error that stopped it
+int FileSys::lock_tree(short blk_num, bool subdir, BlockLockSet& held, vector<short>& blks,
+                       vector<short>& dir_blks) {
+  held.lock(blk_num);
+  if(inodes.pinned(blk_num))
+    return 510;
+
+  if(!subdir) {
+    //The file's data blocks, compressed groups leave slots unused
+    inode_t inode;
+    if(!bfs.read_block(blk_num, (void*)&inode))
+      return 509;
+    for(unsigned int i = 0; !(inode.flags & INODE_INLINE) && i < inode_numblk(inode.size); i++) {
+      if(inode.blocks[i])
+        blks.push_back(inode.blocks[i]);
+    }
+    blks.push_back(blk_num);
+    return 0;
+  }
+
+  int err = 0;
+  const DirVersion* dir = load_dir(blk_num, true, err);
+  if(!dir)
+    return err;
+  for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+    short entry = dir->block.dir_entries[i].block_num;
+    if(!entry)
+      continue;
+    err = lock_tree(entry, dir->subdir[i], held, blks, dir_blks);
+    if(err)
+      return err;
+  }
+  blks.push_back(blk_num);
+  dir_blks.push_back(blk_num);
+  return 0;
+}
+
+// Copies the file or directory blk_num and everything under it, locking
+// them from the top down in held. Data blocks are shared, not copied.
+// Adds every block the copy references to new_blks, to reclaim if it
+// fails. The copied directories and inodes are read-only if read_only
+// is set
+// Returns the block of the copy, or 0 and the error code in err
+short FileSys::copy_tree(short blk_num, bool subdir, BlockLockSet& held, vector<short>& new_blks,
+                         int& err, bool read_only) {
+  held.lock(blk_num);
+
+  if(!subdir) {
+    inode_t inode;
+    if(!bfs.read_block(blk_num, (void*)&inode)) {
+      err = 509;
+      return 0;
+    }
+    //The copy shares the data blocks until either file writes one, so
+    //only the inode is new
+    for(unsigned int i = 0; !(inode.flags & INODE_INLINE) && i < inode_numblk(inode.size); i++) {
+      if(!inode.blocks[i])
+        continue;
+      bfs.share_block(inode.blocks[i]);
+      new_blks.push_back(inode.blocks[i]);
+    }
+    short copy = bfs.get_free_block();
+    if(!copy) {
+      err = 505;
+      return 0;
+    }
+    new_blks.push_back(copy);
+    bfs.write_block(copy, (void*)&inode);
+    if(read_only)
+      bfs.set_read_only(copy);
+    return copy;
+  }
+
+  const DirVersion* dir = load_dir(blk_num, true, err);
+  if(!dir)
+    return 0;
+  dirblock_t dblk = dir->block;
+  for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+    short entry = dblk.dir_entries[i].block_num;
+    if(!entry)
+      continue;
+    dblk.dir_entries[i].block_num = copy_tree(entry, dir->subdir[i], held, new_blks, err,
+                                              read_only);
+    if(!dblk.dir_entries[i].block_num)
+      return 0;
+  }
+  short copy = bfs.get_free_block();
+  if(!copy) {
+    err = 505;
+    return 0;
+  }
+  new_blks.push_back(copy);
+  bfs.write_block(copy, (void*)&dblk);
+  if(read_only)
+    bfs.set_read_only(copy);
+  return copy;
+}
+
+bool FileSys::my_write_block(append_info& app, short& existblk_num, bool full) {
+  //A full block with the same contents as one on disk shares that one
+  //instead of being written, an existing block goes once the append is done
+  if(dedup_blocks && full) {
+    short same = bfs.find_block((void*)&app.datablk);
+    if(same) {
+      if(app.existing_blk) {
+        app.shared_blk = existblk_num;
+        app.copy_blk = same;
+        existblk_num = same;
+      } else {
+        app.datablk_nums[app.num_datablks++] = same;
+      }
+      return false;
+    }
+  }
+
+  //A block other files share is written to a copy, the others keep it
+  if(app.existing_blk && bfs.block_shared(existblk_num)) {
+    short copy = bfs.get_free_block();
+    if(!copy) {
+      for(int x = 0; x < app.num_datablks; x++)
+        bfs.reclaim_block(app.datablk_nums[x]);
+      send_msg(505);
+      return true;
+    }
+    app.shared_blk = existblk_num;
+    app.copy_blk = copy;
+    existblk_num = copy;
+  }
+
   //If the block already existed, write to it
   if(app.existing_blk) {
     bfs.write_block(existblk_num, (void*)&app.datablk);
+    if(dedup_blocks && full)
+      bfs.index_block(existblk_num, (void*)&app.datablk);
   } 
   else {
     //Get a free block for new data block and check if there's space
     short datablk_num = bfs.get_free_block();
     if(!datablk_num) { //If disk is full reclaim all blocks that were written
-      for(int x = 0; x < app.num_datablks; x++) {
+      for(int x = 0; x < app.num_datablks; x++)
         bfs.reclaim_block(app.datablk_nums[x]);
-        delete [] app.datablk_nums;
-      }
+      if(app.copy_blk)
+        bfs.reclaim_block(app.copy_blk);
       send_msg(505);
       return true;
     }
     bfs.write_block(datablk_num, (void*)&app.datablk);
+    if(dedup_blocks && full)
+      bfs.index_block(datablk_num, (void*)&app.datablk);
     app.datablk_nums[app.num_datablks++] = datablk_num;
   }
   return false;
 } 
 
-// sends the corresponding error message given the code
-void FileSys::send_msg(int code, std::string msg) {
-  string final_msg;
-  switch(code) {
-    case 200:
-      final_msg = "200 OK\r\nLength:" + to_string(msg.length()) + "\r\n\r\n" + msg;
-      break;
-    case 500:
-      final_msg = "500 File is not a directory" + ERR_MSG;
-      break;
-    case 501:
-      final_msg = "501 File is a directory" + ERR_MSG;
-      break;
-    case 502:
-      final_msg = "502 File exists" + ERR_MSG;
-      break;
-    case 503:
-      final_msg = "503 File does not exist" + ERR_MSG;
-      break;
-    case 504:
-      final_msg = "504 File name is too long" + ERR_MSG;
-      break;
-    case 505:
-      final_msg = "505 Disk is full" + ERR_MSG;
-      break;
-    case 506:
-      final_msg = "506 Directory is full" + ERR_MSG;
-      break;
-    case 507:
-      final_msg = "507 Directory is not empty" + ERR_MSG;
-      break;
-    case 508:
-      final_msg = "508 Append exceeds maximum file size" + ERR_MSG;
+// appends data to a compressed file, see Blocks.h for the layout
+// Every group the append touches is laid out in memory first, so a full
+// disk is found before any block is written
+void FileSys::append_compressed(short inode_num, inode_t& inode, const char *data, int len_data) {
+  struct group_image {
+    int first_blk;		//first block of the group that changes
+    int num_blks;		//blocks the group is stored in
+    char data[GROUP_SIZE];	//the group as it is stored
+  };
+
+  if(len_data == 0) {
+    send_msg(200);
+    return;
+  }
+  unsigned int end = inode.size + len_data;
+  int first_group = inode.size / GROUP_SIZE;
+  int num_groups = (end - 1) / GROUP_SIZE - first_group + 1;
+  group_image* groups = arena.alloc_array<group_image>(num_groups);
+
+  for(int i = 0; i < num_groups; i++) {
+    group_image& img = groups[i];
+    short* slots = &inode.blocks[(first_group + i) * GROUP_BLOCKS];
+    unsigned int start = (first_group + i) * GROUP_SIZE;
+    unsigned int from = (inode.size > start ? inode.size : start) - start; //first new byte
+    unsigned int to = (end < start + GROUP_SIZE ? end : start + GROUP_SIZE) - start;
+
+    //A group that gets full is compressed and needs all of its bytes,
+    //a partial one only the block the new bytes start in
+    char plain[GROUP_SIZE] = {0};
+    for(unsigned int b = to == GROUP_SIZE ? 0 : from / BLOCK_SIZE; b * BLOCK_SIZE < from; b++) {
+      if(!checkerr_509(slots[b], plain + b * BLOCK_SIZE))
+        return;
+    }
+    memcpy(plain + from, data + (start + from - inode.size), to - from);
+
+    //Keep a full group compressed if that saves at least one block
+    memset(img.data, 0, GROUP_SIZE);
+    int clen = -1;
+    if(to == GROUP_SIZE)
+      clen = lz_compress(plain, GROUP_SIZE, img.data + 2, (GROUP_BLOCKS - 1) * BLOCK_SIZE - 2);
+    if(clen >= 0) {
+      unsigned short len = clen;
+      memcpy(img.data, &len, 2);
+      img.first_blk = 0;
+      img.num_blks = (clen + 2 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    } else {
+      memcpy(img.data, plain, GROUP_SIZE);
+      img.first_blk = from / BLOCK_SIZE;
+      img.num_blks = (to + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+  }
+
+  //Allocate the blocks the groups grow into, and copies of the blocks
+  //other files share
+  short* allocated = arena.alloc_array<short>(num_groups * GROUP_BLOCKS);
+  short* shared = arena.alloc_array<short>(num_groups * GROUP_BLOCKS);
+  int num_allocated = 0, num_shared = 0;
+  for(int i = 0; i < num_groups; i++) {
+    short* slots = &inode.blocks[(first_group + i) * GROUP_BLOCKS];
+    for(int b = groups[i].first_blk; b < groups[i].num_blks; b++) {
+      if(slots[b] && !bfs.block_shared(slots[b]))
+        continue;
+      if(slots[b])
+        shared[num_shared++] = slots[b];
+      slots[b] = bfs.get_free_block();
+      if(!slots[b]) { //If disk is full reclaim the blocks allocated so far
+        for(int x = 0; x < num_allocated; x++)
+          bfs.reclaim_block(allocated[x]);
+        send_msg(505);
+        return;
+      }
+      allocated[num_allocated++] = slots[b];
+    }
+  }
+
+  //Write the groups, a group that got compressed frees its other blocks
+  for(int i = 0; i < num_groups; i++) {
+    int first_slot = (first_group + i) * GROUP_BLOCKS;
+    short* slots = &inode.blocks[first_slot];
+    for(int b = groups[i].first_blk; b < groups[i].num_blks; b++)
+      bfs.write_block(slots[b], (void*)(groups[i].data + b * BLOCK_SIZE));
+    for(int b = groups[i].num_blks; b < GROUP_BLOCKS && first_slot + b < MAX_DATA_BLOCKS; b++) {
+      if(slots[b]) {
+        bfs.reclaim_block(slots[b]);
+        slots[b] = 0;
+      }
+    }
+  }
+
+  inode.size = end;
+  revoke_leases(inode_num);
+  write_inode(inode_num, inode);
+
+  //The file no longer uses the shared blocks it copied
+  bfs.reclaim_blocks(shared, num_shared);
+  send_msg(200);
+}
+
+// returns the number of blocks the group starting at data block blk_index
+// is compressed into, or 0 if it is stored as it is
+int FileSys::compressed_blks(inode_t& inode, int blk_index) {
+  if(!(inode.flags & INODE_COMPRESSED) || blk_index % GROUP_BLOCKS != 0)
+    return 0;
+  if((blk_index + GROUP_BLOCKS) * BLOCK_SIZE > inode.size)
+    return 0;
+  int n = 0;
+  while(n < GROUP_BLOCKS && inode.blocks[blk_index + n])
+    n++;
+  return n < GROUP_BLOCKS ? n : 0;
+}
+
+// reads and decompresses the compressed group starting at data block
+// blk_index into group
+// returns false if a block is corrupt or does not decompress to a full group
+bool FileSys::read_group(inode_t& inode, int blk_index, char* group) {
+  char stored[GROUP_SIZE];
+  int n = compressed_blks(inode, blk_index);
+  for(int b = 0; b < n; b++) {
+    if(!bfs.read_block(inode.blocks[blk_index + b], (void*)(stored + b * BLOCK_SIZE)))
+      return false;
+  }
+  unsigned short len;
+  memcpy(&len, stored, 2);
+  if(len + 2 > n * BLOCK_SIZE)
+    return false;
+  return lz_decompress(stored + 2, len, group, GROUP_SIZE) == GROUP_SIZE;
+}
+
+// reads data blocks of inode ahead of blk_index, as far as end_blk,
+// in the background. missed is true if the block before blk_index
+// came from the disk, which starts reading ahead. A read that goes on
+// where the previous one ended is sequential, and the window doubles
+// each time it catches up with the blocks read ahead, up to RA_MAX
+void FileSys::read_ahead(short inode_num, inode_t& inode, int blk_index, int end_blk,
+                         bool missed) {
+  //Going back or to another file starts a new sequential read
+  if(inode_num != ra_inode || blk_index < ra_next) {
+    ra_inode = inode_num;
+    ra_end = blk_index + 1;
+    ra_window = RA_MIN;
+  }
+  ra_next = blk_index + 1;
+
+  //A file read from memory needs no reading ahead, it starts once a
+  //read had to wait for the disk
+  bool ahead = ra_end > blk_index + 1;
+  if(!ahead && !missed)
+    return;
+
+  //Read the next window once the read is within half a window of the
+  //blocks read ahead so far, a bigger one if it has caught up
+  if(ra_end - blk_index > ra_window / 2 || ra_end >= end_blk)
+    return;
+  if(ahead && ra_window < RA_MAX)
+    ra_window *= 2;
+  int from = ahead ? ra_end : blk_index + 1;
+  int to = blk_index + 1 + ra_window < end_blk ? blk_index + 1 + ra_window : end_blk;
+  short blocks[RA_MAX];
+  int n = 0;
+  for(int b = from; b < to; b++) {
+    if(inode.blocks[b]) //compressed groups leave slots unused
+      blocks[n++] = inode.blocks[b];
+  }
+  bfs.prefetch(blocks, n);
+  ra_end = to;
+}
+
+// Preformatted answers to the error codes, indexed by code - 500
+static const char* const ERR_MSGS[] = {
+  "500 File is not a directory\r\nLength:0\r\n\r\n",
+  "501 File is a directory\r\nLength:0\r\n\r\n",
+  "502 File exists\r\nLength:0\r\n\r\n",
+  "503 File does not exist\r\nLength:0\r\n\r\n",
+  "504 File name is too long\r\nLength:0\r\n\r\n",
+  "505 Disk is full\r\nLength:0\r\n\r\n",
+  "506 Directory is full\r\nLength:0\r\n\r\n",
+  "507 Directory is not empty\r\nLength:0\r\n\r\n",
+  "508 Append exceeds maximum file size\r\nLength:0\r\n\r\n",
+  "509 Block is corrupt\r\nLength:0\r\n\r\n",
+  "510 File is in use\r\nLength:0\r\n\r\n",
+  "511 Too many open files\r\nLength:0\r\n\r\n",
+  "512 Bad file handle\r\nLength:0\r\n\r\n",
+  "513 Directory cannot move into itself\r\nLength:0\r\n\r\n",
+  "514 Snapshot is read-only\r\nLength:0\r\n\r\n",
+  "515 Missing argument\r\nLength:0\r\n\r\n",
+  "516 Name is reserved\r\nLength:0\r\n\r\n"
+};
+
+// sends the corresponding error message given the code, 200 with the
+// len bytes of msg as its body
+void FileSys::send_msg(int code, const char* msg, int len) {
+  //The operation is done once it answers, its block writes commit together
+  unsigned int seq = bfs.commit();
+  request_counters.code = code;
+
+  if(code == 200) {
+    char header[64];
+    int len_header = snprintf(header, sizeof(header), "200 OK\r\nLength:%d\r\n\r\n", len);
+    send_bytes(header, len_header);
+    send_bytes(msg, len);
+  } else {
+    const char* err = ERR_MSGS[code - 500];
+    send_bytes(err, strlen(err));
+  }
+
+  //Hold the answer back until the operation is durable and the read
+  //leases it revoked have run out, answers of operations that change
+  //blocks are small enough to wait in out
+  if(seq || lease_wait != LeaseTable::clock::time_point()) {
+    deferred_seq = seq;
+    return;
   }
 
   //Send message
-  char* p = (char*) final_msg.c_str();
+  flush();
+}
+
+// sends the 200 OK headers for a body of the given length that
+// will follow with send_bytes()
+// Adds a Lease:ms header if the response carries a read lease
+// returns true if the socket write is a success, false otherwise
+bool FileSys::send_header(unsigned int length, bool leased) {
+  bfs.wait_durable(bfs.commit());
+  request_counters.code = 200;
+  char header[64];
+  int len_header;
+  if(leased)
+    len_header = snprintf(header, sizeof(header), "200 OK\r\nLength:%u\r\nLease:%d\r\n\r\n", length, LEASE_MS);
+  else
+    len_header = snprintf(header, sizeof(header), "200 OK\r\nLength:%u\r\n\r\n", length);
+  return send_bytes(header, len_header);
+}
+
+// adds len bytes of buf to the answer, writing out to the socket
+// whenever it fills up
+// returns true if the socket write is a success, false otherwise
+bool FileSys::send_bytes(const char* buf, int len) {
+  while(len > 0) {
+    if(out_len == OUT_SIZE && !flush())
+      return false;
+    int chunk = len < OUT_SIZE - out_len ? len : OUT_SIZE - out_len;
+    memcpy(out + out_len, buf, chunk);
+    out_len += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+  return true;
+}
+
+// writes the answer gathered in out to the socket
+// returns true if the socket write is a success, false otherwise
+bool FileSys::flush() {
+  if(out_len == 0 || error)
+    return !error;
+  TraceScope trace("send", out_len);
   int bytes_sent = 0;
-  int msg_len = strlen(p);
-  while(bytes_sent < msg_len) {
-    int x = write(fs_sock, (void*)p, msg_len - bytes_sent);
+  while(bytes_sent < out_len) {
+    int x = ::write(fs_sock, (void*)(out + bytes_sent), out_len - bytes_sent);
     if(x == -1 || x == 0) {
       perror("write");
-      unmount();
-      error = true; //member variable
+      error = true; //member variable, the session unmounts on it
+      out_len = 0;
+      return false;
     }
-    p += x;
     bytes_sent += x;
   }
+  request_counters.bytes_out += out_len;
+  out_len = 0;
+  return true;
+}
+
+// sends the answer send_msg() held back, once its operation is durable,
+// and ends the request, freeing its scratch memory
+// call once the operation has let go of its locks so other operations can
+// join the same group commit meanwhile
+void FileSys::send_deferred() {
+  if(deferred_seq) {
+    bfs.wait_durable(deferred_seq);
+    deferred_seq = 0;
+  }
+  if(lease_wait != LeaseTable::clock::time_point()) {
+    this_thread::sleep_until(lease_wait);
+    lease_wait = LeaseTable::clock::time_point();
+  }
+  flush();
+  arena.reset();
 }
 
 // returns file system flag if there is an error with the R/W
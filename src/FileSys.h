@@ -6,11 +6,23 @@
 
 #include "BasicFileSys.h"
 #include "Blocks.h"
+#include "Lease.h"
+#include "Lock.h"
+#include "DirCache.h"
+#include "InodeTable.h"
+#include "Arena.h"
 #include <string>
+#include <vector>
 
 class FileSys {
   
   public:
+    // creates a client session on the shared basic file system, lease
+    // table, block locks, directory cache and inode table, the disk must
+    // already be mounted
+    FileSys(BasicFileSys& bfs, LeaseTable& lease_table, LockTable& locks, DirCache& dirs,
+            InodeTable& inodes);
+
     // mounts the file system
     void mount(int sock);
 
@@ -50,19 +62,116 @@ class FileSys {
     // display stats about file or directory
     void stat(const char *name);
 
+    // open a data file, answering with a handle for read() and write()
+    // The file cannot be removed until the handle is closed
+    void open(const char *name);
+
+    // close a handle returned by open()
+    void close(int fd);
+
+    // display the first N bytes of an open file
+    void read(int fd, unsigned int n);
+
+    // append data to an open file
+    void write(int fd, const char *data);
+
+    // delete a directory with everything in it, or a data file
+    // Nothing is deleted if anything in it is in use
+    void rm_tree(const char *name);
+
+    // copy a data file to a new entry of the current directory, sharing
+    // its data blocks until either file is written
+    void cp(const char *src, const char *dst);
+
+    // copy a directory with everything in it, or a data file, to a new
+    // entry of the current directory
+    void cp_tree(const char *src, const char *dst);
+
+    // rename an entry of the current directory, or move it into the
+    // directory at path dst, relative to the current one or from the root
+    // if it starts with /. An existing directory at dst gets the entry
+    // under its old name
+    void mv(const char *src, const char *dst);
+
+    // display the directories, files, bytes and blocks under a directory,
+    // the current one if name is NULL, or of a data file
+    void du(const char *name);
+
+    // freeze the whole tree as a read-only snapshot called name in the
+    // snapshot directory of the root, sharing the data blocks with the
+    // live files
+    void snapshot(const char *name);
+
+    // grant read leases on cat/head/stat responses for a caching client
+    void lease();
+
+    // store the data of files created from now on compressed
+    void set_compression(bool on);
+
+    // share full data blocks with the same contents as one already on disk
+    void set_dedup(bool on);
+
+    // display the server's per-operation counters and latencies
+    void stats();
+
+    // turn tracing on or off, or with "dump" send the trace as Chrome trace JSON
+    void trace(const char *arg);
+
+    // answer a command line that lacks an argument the command needs
+    void missing_arg();
+
+    // sends the answer send_msg() held back, once its operation is durable
+    // and the read leases it revoked have expired, and ends the request,
+    // freeing its scratch memory
+    // call once the operation has let go of its locks so other operations can
+    // join the same group commit meanwhile
+    void send_deferred();
+
     // returns file system flag if there is an error with the R/W
     bool getError() const;
 
   private:
-    BasicFileSys bfs;	// basic file system
+    BasicFileSys& bfs;	// basic file system, shared by all sessions
     short curr_dir;	// current directory
 
     int fs_sock;  // file server socket
 
+    int session;  // id of the client session using the file system
+    bool lease_on = false; // true if the client wants read leases
+    bool compress_files = false; // true if new files are created compressed
+    bool dedup_blocks = false; // true if full data blocks are shared by contents
+    LeaseTable& lease_table; // read leases handed out to caching clients
+    LockTable& locks; // directory and inode locks shared by all sessions
+    DirCache& dirs; // directory versions for lookups without locks
+    InodeTable& inodes; // files and directories in use, inodes of open files
+
+    static const int MAX_HANDLES = 16; //files a session can have open
+    short handles[MAX_HANDLES]; //inode of each open handle, 0 if the handle is free
+
     // Additional private variables and Helper functions - if desired
     bool error = false; //Used to clean exit the listening socket on socket failure
 
-    const std::string ERR_MSG = "\r\nLength:0\r\n\r\n"; //append to error messages
+    Arena arena; //scratch memory of the current request, freed by send_deferred()
+
+    static const int OUT_SIZE = 8192; //enough for any answer but a streamed body
+    char out[OUT_SIZE]; //answer bytes not written to the socket yet
+    int out_len = 0;
+    unsigned int deferred_seq = 0; //journal transaction the answer in out waits for, 0 if none
+    LeaseTable::clock::time_point lease_wait; //time the leases the answer waits for run out, epoch if none
+
+    static const int RA_MIN = 2;  //blocks a sequential read first reads ahead
+    static const int RA_MAX = 16; //most blocks read ahead
+    short ra_inode = 0; //file the session reads sequentially
+    int ra_next = 0;    //data block the next sequential read is at
+    int ra_end = 0;     //data block read-ahead has got to
+    int ra_window = 0;  //blocks read ahead each time
+
+    struct tree_usage { //totals of a subtree, added up by scan_tree()
+      unsigned int dirs = 0;
+      unsigned int files = 0;
+      unsigned long long bytes = 0;
+      unsigned int blocks = 0;
+    };
 
     struct append_info { //helper struct to pass arguments to function append()
       int blk_index;
@@ -70,52 +179,192 @@ class FileSys {
       int num_datablks;
       bool existing_blk;
       datablock_t datablk;
+      short shared_blk; //block shared with other files that a copy was written in place of, 0 if none
+      short copy_blk;   //that copy, or a block with the same contents
     };
 
     // returns true if the block is a directory
     bool is_dir(void* block); 
 
     // if file DNE returns 0, else returns the block number of the file.
-    short file_exists(void* block, const char *name);
+    // Sets subdir to whether the entry is a directory if given
+    short file_exists(const DirVersion* dir, const char *name, bool* subdir=NULL);
 
     // simple formula that returns the number of data blocks in an inode
-    unsigned int inode_numblk(unsigned int& size);
+    unsigned int inode_numblk(unsigned int size);
 
-    // Checks if file exists and if the file is a directory
-    // Basically combines is_dir and file_exists
+    // Checks if file exists in dir and if the file is a directory
     // Sends error corresponding error messages using send_msg()
-    // Reads the block into dblk parameter if file exists
+    // Locks the block with lock if one is given
     // Returns dir block number if file exists
-    short checkerr_500_503(void* block, void* dblk, const char *name);
+    short checkerr_500_503(const DirVersion* dir, const char *name, BlockLock* lock=NULL);
 
-    // Basically the same as checkerr_500_503
+    // Basically the same as checkerr_500_503, looking in the cwd
     // Checks if file exists and if the file is a file
     // Sends error corresponding error messages using send_msg()
     // Reads the block into inode parameter if file exists
+    // Locks the block with lock first if one is given, and looks the file
+    // up again if the cwd changed before it was locked
     // Returns inode block number if the file exists
-    short checkerr_501_503(void* block, void* inode, const char *name);
+    short checkerr_501_503(void* inode, const char *name, BlockLock* lock=NULL);
 
     // Checks if fname is valid and disk is not full
     // Sends error corresponding error messages using send_msg()
     // if fname is valid and disk not full returns free block number, else return 0
     short checkerr_504_505(size_t& len_name);
 
-    // Gets cwd dir block
+    // Reads block blk_num into block
+    // Sends error 509 using send_msg() if it does not match its checksum
+    // Returns - true on success
+    bool checkerr_509(short blk_num, void* block);
+
+    // Returns the inode block number of open handle fd
+    // Sends error 512 using send_msg() and returns 0 if fd is not open
+    short checkerr_512(int fd);
+
+    // Checks that blk_num is not part of a snapshot
+    // Sends error 514 using send_msg() if it is
+    // Returns - true if blk_num can be changed
+    bool checkerr_514(short blk_num);
+
+    // Checks that name is free to use in directory dir_num, the root keeps
+    // SNAPSHOT_DIR for the snapshots
+    // Sends error 516 using send_msg() if it is not
+    // Returns - true if name can be given to a new entry
+    bool checkerr_516(short dir_num, const char *name);
+
+    // Revokes the read leases on blk_num before it changes, the answer is
+    // held back until the leases of other sessions have run out
+    void revoke_leases(short blk_num);
+
+    // Makes blk_num the cwd, the session uses it until it moves on
+    // The directory must be locked, or be the root
+    void set_cwd(short blk_num);
+
+    // writes inode to its block, and to the inode table if the file is open
+    void write_inode(short inode_num, inode_t& inode);
+
+    // sends the first n bytes of the file, the file must be locked
+    void send_file(short inode_num, inode_t& inode, unsigned int n);
+
+    // appends data to the file, the file must be locked exclusively
+    void append_file(short inode_num, inode_t& inode, const char *data);
+
+    // Returns the current version of directory blk_num, reading it into
+    // the directory cache first if it is not cached yet. The read takes the
+    // directory's shared lock unless locked says the caller holds its lock.
+    // Sends error 500 or 509 using send_msg() and returns NULL on failure
+    const DirVersion* get_dir(short blk_num, bool locked=false);
+
+    // Same as get_dir(), but safe on any thread: sets err to the error code
+    // instead of sending it. If parent is given, blk_num was an entry of
+    // that directory, and err is 503 if it is gone by the time blk_num is
+    // locked.
+    const DirVersion* load_dir(short blk_num, bool locked, int& err, short parent=0);
+
+    // Adds the file or directory blk_num, an entry of directory parent, to
+    // usage. Each block is locked shared only while
+    // it is read, and entries removed meanwhile are left out, so any thread
+    // can scan. Callers hold a DirCache::Reader.
+    // Returns 0, 503 if blk_num itself is gone, or the error that stopped it
+    int scan_tree(short blk_num, bool subdir, short parent, tree_usage& usage);
+
+    // Same as scan_tree() for directory blk_num, with its subdirectories
+    // scanned by one worker thread per CPU
+    int scan_tree_parallel(short blk_num, short parent, tree_usage& usage);
+
+    // true if the current version of directory parent lists blk_num
+    bool listed(short parent, short blk_num);
+
+    // Locks the file or directory blk_num and everything under it from the
+    // top down in held, and adds their blocks to blks and the directories
+    // to dir_blks
+    // Returns 0, 510 if any of it is in use, or the error that stopped it
+    int lock_tree(short blk_num, bool subdir, BlockLockSet& held, std::vector<short>& blks,
+                  std::vector<short>& dir_blks);
+
+    // Copies entry src of the cwd to new entry dst, with everything under
+    // it if it is a directory and recursive is set
+    void copy_entry(const char *src, const char *dst, bool recursive);
+
+    // Looks up the directory path leads to, relative to the cwd or from the
+    // root if it starts with /, without locks. Sets dir_num to it and
+    // parent to its parent, 0 if it is where the path starts, and adds
+    // every directory on the way to visited. Callers hold a
+    // DirCache::Reader.
+    // Sends error 500 or 503 using send_msg() and returns NULL on failure
+    const DirVersion* lookup_path(const std::string& path, short& dir_num, short& parent,
+                                  std::vector<short>& visited);
+
+    // Copies the file or directory blk_num and everything under it, locking
+    // them from the top down in held. Data blocks are shared, not copied.
+    // Adds every block the copy references to new_blks, to reclaim if it
+    // fails. The copied directories and inodes are read-only if read_only
+    // is set
+    // Returns the block of the copy, or 0 and the error code in err
+    short copy_tree(short blk_num, bool subdir, BlockLockSet& held, std::vector<short>& new_blks,
+                    int& err, bool read_only=false);
+
+    // Gets cwd dir version, the cwd must be locked exclusively
     // Updates the curr dir by adding the new dir entry to an empty spot
+    // and publishes the new version
     // Returns - true on success
-    bool add_cwd(short blk_num, const char *name, size_t& len_name);
+    bool add_cwd(short blk_num, const char *name, bool subdir=false);
+
+    // Same as add_cwd() for directory dir_num, which must be locked
+    // exclusively
+    bool add_entry(short dir_num, short blk_num, const char *name, bool subdir=false);
 
-    // Given the dir block for the cwd, removes the dir entry for file
-    void rem_cwd(void* blk, short blk_num);
+    // Given the version of the cwd, removes the dir entry for file and
+    // publishes the new version
+    void rem_cwd(const DirVersion* cwd, short blk_num);
 
     // Fat helper function to write a data block that already exists,
     // or to a new block. append_info is just to pass more variables and,
-    // reduce the argument amounts. Returns false if no errors occur.
-    bool my_write_block(append_info& app, int& count, int& len_data, short& existblk_num);
+    // reduce the argument amounts. full is true if the block is full.
+    // Returns false if no errors occur.
+    bool my_write_block(append_info& app, short& existblk_num, bool full);
+
+    // appends data to a compressed file, see Blocks.h for the layout
+    // Every group the append touches is laid out in memory first, so a full
+    // disk is found before any block is written
+    void append_compressed(short inode_num, inode_t& inode, const char *data, int len_data);
+
+    // returns the number of blocks the group starting at data block blk_index
+    // is compressed into, or 0 if it is stored as it is
+    int compressed_blks(inode_t& inode, int blk_index);
+
+    // reads and decompresses the compressed group starting at data block
+    // blk_index into group
+    // returns false if a block is corrupt or does not decompress to a full group
+    bool read_group(inode_t& inode, int blk_index, char* group);
+
+    // reads data blocks of inode ahead of blk_index, as far as end_blk,
+    // in the background. missed is true if the block before blk_index
+    // came from the disk, which starts reading ahead. A read that goes on
+    // where the previous one ended is sequential, and the window doubles
+    // each time it catches up with the blocks read ahead, up to RA_MAX
+    void read_ahead(short inode_num, inode_t& inode, int blk_index, int end_blk,
+                    bool missed);
+
+    // sends the corresponding error message given the code, 200 with the
+    // len bytes of msg as its body
+    void send_msg(int code, const char* msg="", int len=0);
+
+    // sends the 200 OK headers for a body of the given length that
+    // will follow with send_bytes()
+    // returns true if the socket write is a success, false otherwise
+    // Adds a Lease:ms header if the response carries a read lease
+    bool send_header(unsigned int length, bool leased=false);
+
+    // adds len bytes of buf to the answer, writing out to the socket
+    // whenever it fills up
+    // returns true if the socket write is a success, false otherwise
+    bool send_bytes(const char* buf, int len);
 
-    // sends the corresponding error message given the code
+    // writes the answer gathered in out to the socket
     // returns true if the socket write is a success, false otherwise
-    void send_msg(int code, std::string msg="");
+    bool flush();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+// CPSC 3500: Inode table
+// Counts the sessions using each file or directory, through an open file
+// handle or as their current directory, and keeps the inodes of open files
+// in memory. A file or directory in use cannot be removed, and reads and
+// appends by handle take the inode from here instead of looking the file
+// up in its directory and reading its inode block.
+
+using namespace std;
+
+#include "InodeTable.h"
+
+InodeTable::InodeTable() {
+  for(int i = 0; i < NUM_BLOCKS; i++) {
+    uses[i] = 0;
+    inodes[i] = NULL;
+  }
+}
+
+InodeTable::~InodeTable() {
+  for(int i = 0; i < NUM_BLOCKS; i++)
+    delete inodes[i];
+}
+
+// Adds a use of block blk_num. The inode of a file is given and kept
+// from its first use on, directories pass NULL.
+void InodeTable::pin(short blk_num, const inode_t* inode) {
+  lock_guard<mutex> guard(lock);
+  uses[blk_num]++;
+  //Other sessions keep the inode up to date once it is kept
+  if(inode && !inodes[blk_num])
+    inodes[blk_num] = new inode_t(*inode);
+}
+
+// Drops a use of block blk_num, and its inode with the last one.
+void InodeTable::unpin(short blk_num) {
+  lock_guard<mutex> guard(lock);
+  if(--uses[blk_num] == 0) {
+    delete inodes[blk_num];
+    inodes[blk_num] = NULL;
+  }
+}
+
+// true if some session uses block blk_num
+bool InodeTable::pinned(short blk_num) {
+  lock_guard<mutex> guard(lock);
+  return uses[blk_num] > 0;
+}
+
+// Copies the inode kept for inode_num into inode. Returns false if
+// none is kept.
+bool InodeTable::read(short inode_num, inode_t* inode) {
+  lock_guard<mutex> guard(lock);
+  if(!inodes[inode_num])
+    return false;
+  *inode = *inodes[inode_num];
+  return true;
+}
+
+// Replaces the inode kept for inode_num, if one is kept.
+void InodeTable::update(short inode_num, const inode_t& inode) {
+  lock_guard<mutex> guard(lock);
+  if(inodes[inode_num])
+    *inodes[inode_num] = inode;
+}
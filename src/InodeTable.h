@@ -0,0 +1,50 @@
+// CPSC 3500: Inode table
+// Counts the sessions using each file or directory, through an open file
+// handle or as their current directory, and keeps the inodes of open files
+// in memory. A file or directory in use cannot be removed, and reads and
+// appends by handle take the inode from here instead of looking the file
+// up in its directory and reading its inode block.
+
+#ifndef INODETABLE_H
+#define INODETABLE_H
+
+#include <mutex>
+
+#include "Blocks.h"
+
+class InodeTable {
+
+  public:
+    InodeTable();
+    ~InodeTable();
+
+    // Adds a use of block blk_num. The inode of a file is given and kept
+    // from its first use on, directories pass NULL. Callers hold the
+    // block's lock, shared or exclusive.
+    void pin(short blk_num, const inode_t* inode = NULL);
+
+    // Drops a use of block blk_num, and its inode with the last one.
+    void unpin(short blk_num);
+
+    // true if some session uses block blk_num. Callers hold the block's
+    // exclusive lock, so no session starts using it meanwhile.
+    bool pinned(short blk_num);
+
+    // Copies the inode kept for inode_num into inode. Returns false if
+    // none is kept. Callers hold the file's lock, shared or exclusive.
+    bool read(short inode_num, inode_t* inode);
+
+    // Replaces the inode kept for inode_num, if one is kept. Callers
+    // hold the file's exclusive lock.
+    void update(short inode_num, const inode_t& inode);
+
+  private:
+    std::mutex lock;	// guards the tables below
+    int uses[NUM_BLOCKS];	// sessions using each block
+    inode_t* inodes[NUM_BLOCKS];	// inode of each open file, NULL if none
+
+    InodeTable(const InodeTable&) = delete;
+    InodeTable& operator=(const InodeTable&) = delete;
+};
+
+#endif
@@ -0,0 +1,345 @@
+// CPSC 3500: Write-ahead journal
+// Makes each file system operation atomic across crashes. Blocks written
+// by an operation are kept in memory until the operation commits, then
+// logged together as one transaction in the circular journal region of
+// the disk. Transactions are made durable in groups: one fsync covers
+// every transaction committed since the last one, after which their
+// blocks are written to their home locations. Mounting replays committed
+// transactions that may not have reached home before a crash.
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+using namespace std;
+
+#include "Journal.h"
+#include "Trace.h"
+
+// Replays committed transactions left in the journal region of disk,
+// or formats the region if the disk has none, and starts the group
+// commit thread. Blocks written home are recorded in checksums.
+void Journal::mount(Disk *disk, ChecksumTable *checksums)
+{
+  this->disk = disk;
+  this->checksums = checksums;
+
+  journal_header_t header;
+  bool formatted = disk->num_blocks() >= CSUM_START;
+  if (formatted) {
+    disk->read_block(JOURNAL_START, (void *) &header);
+    formatted = header.magic == JOURNAL_MAGIC_NUM;
+  }
+
+  if (formatted) {
+    head = tail = header.head;
+    head_seq = next_seq = header.seq;
+    int replayed = replay();
+    if (replayed > 0)
+      cerr << "Journal: replayed " << replayed << " transactions" << endl;
+  } else {
+    // zero the log so no stale block passes for a record
+    datablock_t zero;
+    memset(zero.data, 0, BLOCK_SIZE);
+    for (int i = 0; i < JOURNAL_BLOCKS; i++)
+      write_log(i, (void *) &zero);
+    head = tail = 0;
+    head_seq = next_seq = 1;
+  }
+
+  // the log now starts at tail, the header must say so before new
+  // records can overwrite the old ones
+  checksums->flush();
+  disk->sync();
+  write_header(tail, next_seq);
+  disk->sync();
+  head = tail;
+  head_seq = next_seq;
+  durable_seq = next_seq - 1;
+
+  running = true;
+  flusher = thread(&Journal::flush_loop, this);
+}
+
+// Lets the group commit thread go if the process exits still mounted
+Journal::~Journal()
+{
+  if (flusher.joinable())
+    flusher.detach();
+}
+
+// Sets when operations count as durable, DURABILITY_PERIODIC by default.
+void Journal::set_durability(Durability mode)
+{
+  lock_guard<mutex> guard(lock);
+  durability = mode;
+}
+
+// Stops the group commit thread and makes everything committed durable.
+void Journal::unmount()
+{
+  {
+    lock_guard<mutex> guard(lock);
+    running = false;
+  }
+  flush_cv.notify_one();
+  flusher.join();
+  sync(true);
+}
+
+// Looks up block_num among the blocks written but not yet written home.
+// Returns true and copies it into block if found.
+bool Journal::read(short block_num, void *block)
+{
+  lock_guard<mutex> guard(lock);
+  map<short, datablock_t>::iterator it = overlay.find(block_num);
+  if (it == overlay.end())
+    return false;
+  memcpy(block, it->second.data, BLOCK_SIZE);
+  return true;
+}
+
+// Writes block_num as part of the calling thread's open transaction.
+void Journal::write(short block_num, const void *block)
+{
+  lock_guard<mutex> guard(lock);
+  memcpy(overlay[block_num].data, block, BLOCK_SIZE);
+  open_txns[this_thread::get_id()].insert(block_num);
+}
+
+// Logs the blocks the calling thread wrote since its last commit as
+// one transaction. It becomes durable with the next group commit.
+// Returns the sequence number to pass to wait_durable() before
+// answering, or 0 if the answer need not wait.
+unsigned int Journal::commit()
+{
+  unique_lock<mutex> guard(lock);
+  map<thread::id, set<short> >::iterator it = open_txns.find(this_thread::get_id());
+  if (it == open_txns.end())
+    return 0;
+  TraceScope trace("journal_commit", it->second.size());
+
+  // log blocks, one descriptor per JDESC_ENTRIES of them, and a commit record
+  int n = it->second.size();
+  unsigned long long need = n + (n + JDESC_ENTRIES - 1) / JDESC_ENTRIES + 1;
+
+  // The transaction stays open while waiting for journal space, so no
+  // group commit drops its blocks from the overlay meanwhile. Free journal
+  // space by checkpointing if the log is too full; the log holds even a
+  // transaction of every block, so an empty one always has room
+  while (tail + need - head > (unsigned long long) JOURNAL_BLOCKS) {
+    guard.unlock();
+    sync(true);
+    guard.lock();
+  }
+  it = open_txns.find(this_thread::get_id());
+  vector<short> blocks(it->second.begin(), it->second.end());
+  open_txns.erase(it);
+
+  unsigned int seq = next_seq++;
+  for (int first = 0; first < n; first += JDESC_ENTRIES) {
+    jdesc_t desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.magic = JDESC_MAGIC_NUM;
+    desc.seq = seq;
+    desc.count = n - first < JDESC_ENTRIES ? n - first : JDESC_ENTRIES;
+    for (unsigned int i = 0; i < desc.count; i++)
+      desc.block_nums[i] = blocks[first + i];
+    write_log(tail++, (void *) &desc);
+    for (unsigned int i = 0; i < desc.count; i++) {
+      datablock_t& block = overlay[blocks[first + i]];
+      write_log(tail++, (void *) &block);
+      committed[blocks[first + i]] = block;
+    }
+  }
+  jcommit_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = JCOMMIT_MAGIC_NUM;
+  rec.seq = seq;
+  rec.num_blocks = n;
+  write_log(tail++, (void *) &rec);
+
+  if (++pending >= GROUP_COMMIT_MAX)
+    flush_cv.notify_one();
+  return durability == DURABILITY_REQUEST ? seq : 0;
+}
+
+// Waits until transaction seq is durable. Joins the group commit in
+// progress, or runs the next one if none is.
+void Journal::wait_durable(unsigned int seq)
+{
+  if (seq == 0)
+    return;
+  TraceScope trace("wait_durable", seq);
+  unique_lock<mutex> guard(lock);
+  while (durable_seq < seq) {
+    if (syncing) {
+      durable_cv.wait(guard);
+    } else {
+      guard.unlock();
+      sync();
+      guard.lock();
+    }
+  }
+}
+
+// Group commit: makes all committed transactions durable with one
+// fsync and writes their blocks home. With checkpoint, also frees the
+// journal space of every transaction up to now.
+void Journal::sync(bool checkpoint)
+{
+  lock_guard<mutex> one_sync(sync_lock);
+  TraceScope trace(checkpoint ? "journal_checkpoint" : "journal_sync");
+
+  // take the batch of transactions committed so far
+  map<short, datablock_t> batch;
+  unsigned long long batch_tail;
+  unsigned int batch_seq;
+  bool do_fsync;
+  {
+    lock_guard<mutex> guard(lock);
+    batch.swap(committed);
+    pending = 0;
+    batch_tail = tail;
+    batch_seq = next_seq;
+    do_fsync = durability != DURABILITY_NONE;
+    if (batch.empty() && !checkpoint) {
+      durable_seq = batch_seq - 1;
+      return;
+    }
+    syncing = true;
+  }
+
+  // one fsync makes the whole batch durable, then it can go home
+  if (do_fsync)
+    disk->sync();
+  {
+    lock_guard<mutex> guard(lock);
+    durable_seq = batch_seq - 1;
+    syncing = false;
+  }
+  durable_cv.notify_all();
+  for (map<short, datablock_t>::iterator it = batch.begin(); it != batch.end(); it++)
+    write_home(it->first, it->second);
+  checksums->flush();
+
+  // blocks now home can be read from disk again, unless they have
+  // been written since
+  {
+    lock_guard<mutex> guard(lock);
+    for (map<short, datablock_t>::iterator it = batch.begin(); it != batch.end(); it++) {
+      map<short, datablock_t>::iterator o = overlay.find(it->first);
+      if (o != overlay.end() && !is_open(it->first) &&
+          memcmp(o->second.data, it->second.data, BLOCK_SIZE) == 0)
+        overlay.erase(o);
+    }
+  }
+
+  // Every transaction before batch_tail is home once that is durable,
+  // so replay can start at batch_tail
+  if (checkpoint) {
+    if (do_fsync)
+      disk->sync();
+    write_header(batch_tail, batch_seq);
+    if (do_fsync)
+      disk->sync();
+    lock_guard<mutex> guard(lock);
+    head = batch_tail;
+    head_seq = batch_seq;
+  }
+}
+
+// Writes block to its home location block_num and records its checksum
+void Journal::write_home(short block_num, const datablock_t& block)
+{
+  disk->write_block(block_num, (void *) &block);
+  checksums->update(block_num, (const void *) &block);
+}
+
+// Writes block to log position pos
+void Journal::write_log(unsigned long long pos, const void *block)
+{
+  disk->write_block(JOURNAL_START + 1 + pos % JOURNAL_BLOCKS, (void *) block);
+}
+
+// Reads log position pos into block
+void Journal::read_log(unsigned long long pos, void *block)
+{
+  disk->read_block(JOURNAL_START + 1 + pos % JOURNAL_BLOCKS, block);
+}
+
+// Writes the journal header for a log starting at pos with seq
+void Journal::write_header(unsigned long long pos, unsigned int seq)
+{
+  journal_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = JOURNAL_MAGIC_NUM;
+  header.head = pos % JOURNAL_BLOCKS;
+  header.seq = seq;
+  disk->write_block(JOURNAL_START, (void *) &header);
+}
+
+// Redoes the committed transactions in the log, returns how many
+int Journal::replay()
+{
+  int replayed = 0;
+  for (;;) {
+    // gather one transaction, stop at the first incomplete one
+    map<short, datablock_t> txn;
+    unsigned long long pos = tail;
+    bool complete = false;
+    while (pos - tail < (unsigned long long) JOURNAL_BLOCKS) {
+      datablock_t block;
+      read_log(pos++, (void *) &block);
+      jdesc_t *desc = (jdesc_t *) &block;
+      jcommit_t *rec = (jcommit_t *) &block;
+      if (desc->magic == JDESC_MAGIC_NUM && desc->seq == next_seq &&
+          desc->count <= (unsigned int) JDESC_ENTRIES) {
+        jdesc_t d = *desc;
+        for (unsigned int i = 0; i < d.count; i++) {
+          if (d.block_nums[i] < 0 || d.block_nums[i] >= NUM_BLOCKS)
+            return replayed;
+          read_log(pos++, (void *) &txn[d.block_nums[i]]);
+        }
+      } else if (rec->magic == JCOMMIT_MAGIC_NUM && rec->seq == next_seq) {
+        complete = true;
+        break;
+      } else {
+        break;
+      }
+    }
+    if (!complete)
+      return replayed;
+
+    for (map<short, datablock_t>::iterator it = txn.begin(); it != txn.end(); it++)
+      write_home(it->first, it->second);
+    tail = pos;
+    next_seq++;
+    replayed++;
+  }
+}
+
+// true if block_num is part of an open transaction
+bool Journal::is_open(short block_num)
+{
+  for (map<thread::id, set<short> >::iterator it = open_txns.begin(); it != open_txns.end(); it++) {
+    if (it->second.count(block_num))
+      return true;
+  }
+  return false;
+}
+
+// Runs group commits until unmount
+void Journal::flush_loop()
+{
+  unique_lock<mutex> guard(lock);
+  while (running) {
+    flush_cv.wait_for(guard, chrono::milliseconds(GROUP_COMMIT_MS),
+                      [this]() { return !running || pending >= GROUP_COMMIT_MAX; });
+    if (pending > 0) {
+      guard.unlock();
+      sync();
+      guard.lock();
+    }
+  }
+}
@@ -0,0 +1,129 @@
+// CPSC 3500: Write-ahead journal
+// Makes each file system operation atomic across crashes. Blocks written
+// by an operation are kept in memory until the operation commits, then
+// logged together as one transaction in the circular journal region of
+// the disk. Transactions are made durable in groups: one fsync covers
+// every transaction committed since the last one, after which their
+// blocks are written to their home locations. Mounting replays committed
+// transactions that may not have reached home before a crash.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "Disk.h"
+#include "Checksum.h"
+#include "Blocks.h"
+
+// A group commit is forced once this many transactions are waiting
+const int GROUP_COMMIT_MAX = 16;
+
+// Committed transactions wait at most this long for their group commit
+const int GROUP_COMMIT_MS = 20;
+
+// When an operation counts as durable
+enum Durability {
+  DURABILITY_NONE,	// never fsync, a crash can lose or tear recent operations
+  DURABILITY_PERIODIC,	// group commit every GROUP_COMMIT_MS, answer right away
+  DURABILITY_REQUEST	// answer once the group commit covering the operation is done
+};
+
+class Journal {
+
+  public:
+    // Replays committed transactions left in the journal region of disk,
+    // or formats the region if the disk has none, and starts the group
+    // commit thread. Blocks written home are recorded in checksums.
+    void mount(Disk *disk, ChecksumTable *checksums);
+
+    // Lets the group commit thread go if the process exits still mounted
+    ~Journal();
+
+    // Sets when operations count as durable, DURABILITY_PERIODIC by default.
+    void set_durability(Durability mode);
+
+    // Stops the group commit thread and makes everything committed durable.
+    void unmount();
+
+    // Looks up block_num among the blocks written but not yet written home.
+    // Returns true and copies it into block if found.
+    bool read(short block_num, void *block);
+
+    // Writes block_num as part of the calling thread's open transaction.
+    void write(short block_num, const void *block);
+
+    // Logs the blocks the calling thread wrote since its last commit as
+    // one transaction. It becomes durable with the next group commit.
+    // Returns the sequence number to pass to wait_durable() before
+    // answering, or 0 if the answer need not wait.
+    unsigned int commit();
+
+    // Waits until transaction seq is durable. Joins the group commit in
+    // progress, or runs the next one if none is.
+    void wait_durable(unsigned int seq);
+
+    // Group commit: makes all committed transactions durable with one
+    // fsync and writes their blocks home. With checkpoint, also frees the
+    // journal space of every transaction up to now.
+    void sync(bool checkpoint = false);
+
+  private:
+    Disk *disk;
+    ChecksumTable *checksums;	// checksums of the blocks written home
+
+    std::mutex lock;		// guards the journal state below
+    std::mutex sync_lock;	// one group commit at a time
+
+    // latest contents of blocks that are not written home yet
+    std::map<short, datablock_t> overlay;
+
+    // blocks each thread wrote since its last commit
+    std::map<std::thread::id, std::set<short> > open_txns;
+
+    // logged blocks waiting for the next group commit
+    std::map<short, datablock_t> committed;
+
+    int pending = 0;		// transactions committed since the last sync
+
+    Durability durability = DURABILITY_PERIODIC; // when operations count as durable
+    unsigned int durable_seq = 0; // transactions up to this one are durable
+    bool syncing = false;	// true while a group commit runs
+    std::condition_variable durable_cv; // wakes threads in wait_durable
+
+    unsigned long long head = 0; // log position of the oldest transaction to keep
+    unsigned long long tail = 0; // log position the next record goes to
+    unsigned int head_seq = 0;	// sequence number of the transaction at head
+    unsigned int next_seq = 0;	// sequence number of the next transaction
+
+    std::thread flusher;	// runs group commits every GROUP_COMMIT_MS
+    bool running = false;	// true while the flusher should run
+    std::condition_variable flush_cv; // wakes the flusher early
+
+    // Writes block to its home location block_num and records its checksum
+    void write_home(short block_num, const datablock_t& block);
+
+    // Writes block to log position pos
+    void write_log(unsigned long long pos, const void *block);
+
+    // Reads log position pos into block
+    void read_log(unsigned long long pos, void *block);
+
+    // Writes the journal header for a log starting at pos with seq
+    void write_header(unsigned long long pos, unsigned int seq);
+
+    // Redoes the committed transactions in the log, returns how many
+    int replay();
+
+    // true if block_num is part of an open transaction
+    bool is_open(short block_num);
+
+    // Runs group commits until unmount
+    void flush_loop();
+};
+
+#endif
@@ -0,0 +1,40 @@
+// CPSC 3500: Leases
+// Tracks the read leases the server hands out to caching clients, so that
+// a mutation can wait out the leases other sessions hold on a block.
+
+using namespace std;
+
+#include "Lease.h"
+
+// Grants session a read lease on block blk_num that lasts LEASE_MS.
+void LeaseTable::grant(short blk_num, int session) {
+  clock::time_point expiry = clock::now() + chrono::milliseconds(LEASE_MS);
+  lock_guard<mutex> guard(lock);
+
+  //Renew the lease if the session already holds one
+  auto range = leases.equal_range(blk_num);
+  for(auto it = range.first; it != range.second; it++) {
+    if(it->second.session == session) {
+      it->second.expiry = expiry;
+      return;
+    }
+  }
+  lease_t lease = {session, expiry};
+  leases.insert(make_pair(blk_num, lease));
+}
+
+// Revokes all leases on block blk_num before it is changed by session.
+// Leases of other sessions cannot be recalled, so this returns the
+// time the last of them expires.
+LeaseTable::clock::time_point LeaseTable::revoke(short blk_num, int session) {
+  clock::time_point wait_until = clock::now();
+
+  lock_guard<mutex> guard(lock);
+  auto range = leases.equal_range(blk_num);
+  for(auto it = range.first; it != range.second; it++) {
+    if(it->second.session != session && it->second.expiry > wait_until)
+      wait_until = it->second.expiry;
+  }
+  leases.erase(blk_num);
+  return wait_until;
+}
@@ -0,0 +1,43 @@
+// CPSC 3500: Leases
+// Tracks the read leases the server hands out to caching clients, so that
+// a mutation can wait out the leases other sessions hold on a block.
+
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <map>
+#include <chrono>
+#include <mutex>
+
+// Length of a read lease in milliseconds
+const int LEASE_MS = 1000;
+
+class LeaseTable {
+
+  public:
+    // Grants session a read lease on block blk_num that lasts LEASE_MS.
+    void grant(short blk_num, int session);
+
+    typedef std::chrono::steady_clock clock;
+
+    // Revokes all leases on block blk_num before it is changed by session.
+    // Leases of other sessions cannot be recalled, so this returns the
+    // time the last of them expires, which the answer to the change has
+    // to wait for. The session's own lease is dropped right away, the
+    // client invalidates its own cache when it issues the change.
+    clock::time_point revoke(short blk_num, int session);
+
+  private:
+
+    struct lease_t {
+      int session;		// session holding the lease
+      clock::time_point expiry;	// time the lease runs out
+    };
+
+    // leases by block number, there can be one per session
+    std::multimap<short, lease_t> leases;
+
+    std::mutex lock;	// guards leases, sessions run on their own threads
+};
+
+#endif
@@ -0,0 +1,110 @@
+// CPSC 3500: Locks
+// Reader-writer locks on directory and inode blocks, so sessions running
+// on their own threads can use the file system at once. An operation
+// that locks its current directory and an entry in it takes the directory
+// first, so locks are always taken from the root down and cannot deadlock.
+
+using namespace std;
+
+#include "Lock.h"
+#include "Trace.h"
+
+LockTable::LockTable() {
+  //Prefer writers, a stream of cats must not starve an append
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  for(int i = 0; i < NUM_BLOCKS; i++)
+    pthread_rwlock_init(&locks[i], &attr);
+  pthread_rwlockattr_destroy(&attr);
+}
+
+LockTable::~LockTable() {
+  for(int i = 0; i < NUM_BLOCKS; i++)
+    pthread_rwlock_destroy(&locks[i]);
+}
+
+// Locks block blk_num in the given mode, waiting as long as needed.
+void LockTable::lock(short blk_num, LockMode mode) {
+  pthread_rwlock_t* l = &locks[blk_num];
+  if(mode == LOCK_SHARED) {
+    if(pthread_rwlock_tryrdlock(l) == 0)
+      return;
+    TraceScope trace("lock_wait", blk_num);
+    pthread_rwlock_rdlock(l);
+  } else {
+    if(pthread_rwlock_trywrlock(l) == 0)
+      return;
+    TraceScope trace("lock_wait", blk_num);
+    pthread_rwlock_wrlock(l);
+  }
+}
+
+// Locks block blk_num in the given mode if no one holds it in the way.
+// Returns true if it did.
+bool LockTable::try_lock(short blk_num, LockMode mode) {
+  pthread_rwlock_t* l = &locks[blk_num];
+  if(mode == LOCK_SHARED)
+    return pthread_rwlock_tryrdlock(l) == 0;
+  return pthread_rwlock_trywrlock(l) == 0;
+}
+
+// Unlocks block blk_num.
+void LockTable::unlock(short blk_num) {
+  pthread_rwlock_unlock(&locks[blk_num]);
+}
+
+// Locks nothing yet, lock() takes the lock later
+BlockLock::BlockLock(LockTable& table, LockMode mode) : table(table), mode(mode) {
+}
+
+// Locks block blk_num right away
+BlockLock::BlockLock(LockTable& table, short blk_num, LockMode mode) : table(table), mode(mode) {
+  lock(blk_num);
+}
+
+// Unlocks the block if it is locked
+BlockLock::~BlockLock() {
+  if(blk_num)
+    table.unlock(blk_num);
+}
+
+// Locks block blk_num, the guard must not hold a block yet
+void BlockLock::lock(short blk_num) {
+  table.lock(blk_num, mode);
+  this->blk_num = blk_num;
+}
+
+// Locks block blk_num if no one holds it in the way, the guard must
+// not hold a block yet. Returns true if it did.
+bool BlockLock::try_lock(short blk_num) {
+  if(!table.try_lock(blk_num, mode))
+    return false;
+  this->blk_num = blk_num;
+  return true;
+}
+
+// Unlocks the block held early, so lock() can take another one
+void BlockLock::unlock() {
+  if(blk_num)
+    table.unlock(blk_num);
+  blk_num = 0;
+}
+
+// Locks nothing yet
+BlockLockSet::BlockLockSet(LockTable& table, LockMode mode) : table(table), mode(mode) {
+}
+
+// Unlocks every block held, the deepest first
+BlockLockSet::~BlockLockSet() {
+  for(size_t i = held.size(); i > 0; i--)
+    table.unlock(held[i - 1]);
+}
+
+// Locks block blk_num too, which the set must not hold yet
+void BlockLockSet::lock(short blk_num) {
+  table.lock(blk_num, mode);
+  held.push_back(blk_num);
+}
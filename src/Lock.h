@@ -0,0 +1,102 @@
+// CPSC 3500: Locks
+// Reader-writer locks on directory and inode blocks, so sessions running
+// on their own threads can use the file system at once. An operation
+// that locks its current directory and an entry in it takes the directory
+// first, so locks are always taken from the root down and cannot deadlock.
+
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+#include <vector>
+#include <mutex>
+
+#include "Blocks.h"
+
+// How a block is locked
+enum LockMode {
+  LOCK_SHARED,		// reading, any number of sessions at once
+  LOCK_EXCLUSIVE	// changing, no other session at all
+};
+
+class LockTable {
+
+  public:
+    LockTable();
+    ~LockTable();
+
+    // Locks block blk_num in the given mode, waiting as long as needed.
+    void lock(short blk_num, LockMode mode);
+
+    // Locks block blk_num in the given mode if no one holds it in the way.
+    // Returns true if it did.
+    bool try_lock(short blk_num, LockMode mode);
+
+    // Unlocks block blk_num.
+    void unlock(short blk_num);
+
+    // Held by every move, so no directory moves while another move looks
+    // up where its entry goes. Taken before any block lock.
+    std::mutex moves;
+
+  private:
+    pthread_rwlock_t locks[NUM_BLOCKS];	// one per block, writers go first
+};
+
+// Holds the lock on one block until it goes out of scope
+class BlockLock {
+
+  public:
+    // Locks nothing yet, lock() takes the lock later
+    BlockLock(LockTable& table, LockMode mode);
+
+    // Locks block blk_num right away
+    BlockLock(LockTable& table, short blk_num, LockMode mode);
+
+    // Unlocks the block if it is locked
+    ~BlockLock();
+
+    // Locks block blk_num, the guard must not hold a block yet
+    void lock(short blk_num);
+
+    // Locks block blk_num if no one holds it in the way, the guard must
+    // not hold a block yet. Returns true if it did.
+    bool try_lock(short blk_num);
+
+    // Unlocks the block held early, so lock() can take another one
+    void unlock();
+
+  private:
+    LockTable& table;
+    LockMode mode;
+    short blk_num = 0;	// block held, 0 if none
+
+    BlockLock(const BlockLock&) = delete;
+    BlockLock& operator=(const BlockLock&) = delete;
+};
+
+// Holds the locks on any number of blocks until it goes out of scope, for
+// operations on a whole subtree. Blocks are locked from the root down like
+// any other locks.
+class BlockLockSet {
+
+  public:
+    // Locks nothing yet
+    BlockLockSet(LockTable& table, LockMode mode);
+
+    // Unlocks every block held
+    ~BlockLockSet();
+
+    // Locks block blk_num too, which the set must not hold yet
+    void lock(short blk_num);
+
+  private:
+    LockTable& table;
+    LockMode mode;
+    std::vector<short> held;	// blocks locked, in the order they were
+
+    BlockLockSet(const BlockLockSet&) = delete;
+    BlockLockSet& operator=(const BlockLockSet&) = delete;
+};
+
+#endif
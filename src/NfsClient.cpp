@@ -0,0 +1,735 @@
+// CPSC 3500: Network File System client
+// Implements the client side of the protocol as a library: every request
+// returns its status, payload and latency instead of printing them, so the
+// shell, benchmarks and other programs can all drive the server with it.
+
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+using namespace std;
+
+#include "NfsClient.h"
+
+// Write-behind thresholds: buffered appends are sent once they reach
+// WB_MAX_BYTES or have waited WB_MAX_MS. The byte limit keeps the
+// request line well inside the server's 4KB command buffer.
+static const unsigned int WB_MAX_BYTES = 2048;
+static const int WB_MAX_MS = 500;
+
+// Returns a result that did not come from the server
+static NfsResult make_result(int code, const string& status) {
+  NfsResult result;
+  result.code = code;
+  result.status = status;
+  result.lease = 0;
+  result.cached = false;
+  result.latency = chrono::microseconds(0);
+  return result;
+}
+
+// Passes everything written to it on to out but the last byte, which is
+// held back and dropped at the end, so a streamed cat body loses the
+// newline it ends with
+class DropLastByte : public streambuf {
+  public:
+    DropLastByte(ostream* out) : out(out), held(false), last(0) {}
+
+  protected:
+    int overflow(int c) {
+      if(c == EOF)
+        return 0;
+      char ch = c;
+      xsputn(&ch, 1);
+      return c;
+    }
+
+    streamsize xsputn(const char* s, streamsize n) {
+      if(n <= 0)
+        return 0;
+      if(held)
+        out->put(last);
+      out->write(s, n - 1);
+      last = s[n - 1];
+      held = true;
+      return n;
+    }
+
+  private:
+    ostream* out;
+    bool held;	//true once last holds a byte not passed on yet
+    char last;
+};
+
+NfsClient::NfsClient() {
+}
+
+// Closes the connections if still mounted
+NfsClient::~NfsClient() {
+  if(mounted)
+    unmount();
+}
+
+// Cache cat/head/stat results under server read leases.
+void NfsClient::enable_cache() {
+  cache_on = true;
+}
+
+// Coalesce consecutive appends to the same file into one request.
+void NfsClient::enable_write_behind() {
+  write_behind = true;
+}
+
+// Opens n connections to the server, independent requests are spread
+// across them. Must be called before mount.
+void NfsClient::set_pool_size(int n) {
+  pool_size = n > 0 ? n : 1;
+}
+
+// Connects to the server at fs_loc, in the format of server:port.
+// Returns a result with code 200 on success and -1 otherwise.
+NfsResult NfsClient::mount(const string& fs_loc) {
+  lock_guard<recursive_mutex> guard(lock);
+
+  //Parse server:port
+  size_t colon = fs_loc.find(':');
+  if(colon == string::npos || colon == 0 || colon == fs_loc.length() - 1 ||
+     fs_loc.find(':', colon + 1) != string::npos)
+    return make_result(-1, "Invalid server address " + fs_loc + ", expected server:port");
+  string host = fs_loc.substr(0, colon);
+  string port = fs_loc.substr(colon + 1);
+
+  //Get address information
+  addrinfo hints, *servinfo;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int rv;
+  if((rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &servinfo)) != 0)
+    return make_result(-1, string("getaddrinfo: ") + gai_strerror(rv));
+
+  //Create socket and attempt to connection with socket
+  cs_sock = connect_server(servinfo);
+  if(cs_sock == -1) {
+    freeaddrinfo(servinfo);
+    return make_result(-1, "Could not connect to " + fs_loc);
+  }
+
+  //Open the rest of the connection pool, each one starts in the root
+  for(int c = 1; c < pool_size; c++) {
+    int sock = connect_server(servinfo);
+    if(sock == -1)
+      break;
+    pool_socks.push_back(sock);
+    pool_cwd.push_back("/");
+  }
+  freeaddrinfo(servinfo);
+  mounted = true;
+  cwd_path = "/";
+
+  //Ask the server for read leases so results can be cached
+  if(cache_on && !send_recv(cs_sock, "lease\r\n").ok())
+    cache_on = false;
+
+  return make_result(200, "200 OK");
+}
+
+// Sends buffered appends and closes the connections
+void NfsClient::unmount() {
+  lock_guard<recursive_mutex> guard(lock);
+  if(mounted)
+    flush_appends();
+  mounted = false;
+
+  ::close(cs_sock);
+  cs_sock = -1;
+  for(size_t c = 0; c < pool_socks.size(); c++)
+    ::close(pool_socks[c]);
+  pool_socks.clear();
+  pool_cwd.clear();
+  cache.clear();
+  open_paths.clear();
+}
+
+// true if connected to the server
+bool NfsClient::is_mounted() const {
+  return mounted;
+}
+
+// path of the current directory on the server
+string NfsClient::cwd() {
+  lock_guard<recursive_mutex> guard(lock);
+  return cwd_path;
+}
+
+// Opens a socket connected to the first reachable address in servinfo.
+// Returns the socket, or -1 if no address could be reached.
+int NfsClient::connect_server(addrinfo* servinfo) {
+  int sock = -1;
+  for(addrinfo* p = servinfo; p != NULL; p = p->ai_next) {
+    if((sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+      continue;
+    if(connect(sock, p->ai_addr, p->ai_addrlen) == -1) {
+      ::close(sock);
+      sock = -1;
+      continue;
+    }
+    break; //End loop once conn
+  }
+  return sock;
+}
+
+// Sends the command line over socket sock and receives the response.
+// The body is streamed to out chunk by chunk as it arrives, so the response
+// size is not bounded by a receive buffer. It is kept in the result if out
+// is not given or keep_body is set.
+NfsResult NfsClient::send_recv(int sock, const string& cmd, ostream* out,
+                               bool keep_body) {
+  clock::time_point start = clock::now();
+  NfsResult result = make_result(-1, "");
+
+  //Send
+  size_t bytes_sent = 0;
+  while(bytes_sent < cmd.length()) {
+    ssize_t x = ::write(sock, cmd.c_str() + bytes_sent, cmd.length() - bytes_sent);
+    if(x == -1 || x == 0) {
+      result.status = string("Connection to server lost: write: ") + strerror(errno);
+      if(sock == cs_sock)
+        mounted = false;
+      return result;
+    }
+    bytes_sent += x;
+  }
+
+  //Receive until the blank line ending the headers is found
+  const int CHUNK_SIZE = 1024;
+  char buf[CHUNK_SIZE];
+  string header = "";
+  size_t header_end;
+  while((header_end = header.find("\r\n\r\n")) == string::npos) {
+    ssize_t x = ::read(sock, (void*)buf, CHUNK_SIZE);
+    if(x == -1 || x == 0) {
+      result.status = string("Connection to server lost: read: ") +
+                      (x == 0 ? "connection closed" : strerror(errno));
+      if(sock == cs_sock)
+        mounted = false;
+      return result;
+    }
+    header.append(buf, x);
+  }
+
+  //If no success there is no body
+  result.status = header.substr(0, header.find("\r\n"));
+  result.code = atoi(result.status.c_str());
+  if(result.status.compare(0, 6, "200 OK") != 0) {
+    result.latency = chrono::duration_cast<chrono::microseconds>(clock::now() - start);
+    return result;
+  }
+
+  //Get the read lease from the optional Lease:ms line
+  size_t lease_pos = header.find("Lease:");
+  if(lease_pos != string::npos && lease_pos < header_end)
+    result.lease = atoi(header.c_str() + lease_pos + 6);
+
+  //Get message body length from the Length:X line
+  int mbody_len = 0;
+  size_t len_pos = header.find("Length:");
+  if(len_pos != string::npos && len_pos < header_end)
+    mbody_len = atoi(header.c_str() + len_pos + 7);
+  bool keep = !out || keep_body;
+
+  //Take the part of the body that came in with the headers
+  int bytes_recv = header.length() - (header_end + 4);
+  if(bytes_recv > mbody_len)
+    bytes_recv = mbody_len;
+  if(out)
+    out->write(header.c_str() + header_end + 4, bytes_recv);
+  if(keep)
+    result.body.assign(header.c_str() + header_end + 4, bytes_recv);
+
+  //Stream the rest of the body as it arrives
+  while(bytes_recv < mbody_len) {
+    int want = mbody_len - bytes_recv < CHUNK_SIZE ? mbody_len - bytes_recv : CHUNK_SIZE;
+    ssize_t x = ::read(sock, (void*)buf, want);
+    if(x == -1 || x == 0) {
+      result.code = -1;
+      result.status = string("Connection to server lost: read: ") +
+                      (x == 0 ? "connection closed" : strerror(errno));
+      if(sock == cs_sock)
+        mounted = false;
+      return result;
+    }
+    if(out)
+      out->write(buf, x);
+    if(keep)
+      result.body.append(buf, x);
+    bytes_recv += x;
+  }
+
+  result.latency = chrono::duration_cast<chrono::microseconds>(clock::now() - start);
+  return result;
+}
+
+// Sends the command line over the main connection, flushing buffered
+// appends first
+NfsResult NfsClient::request(const string& cmd, ostream* out, bool keep_body) {
+  lock_guard<recursive_mutex> guard(lock);
+  if(!mounted)
+    return make_result(-1, "Not connected to a server");
+
+  if(!wb_data.empty()) {
+    NfsResult flushed = flush_appends();
+    if(!flushed.ok())
+      wb_errors.push_back(flushed);
+  }
+  return send_recv(cs_sock, cmd, out, keep_body);
+}
+
+NfsResult NfsClient::mkdir(const string& dname) {
+  return request("mkdir " + dname + "\r\n");
+}
+
+NfsResult NfsClient::cd(const string& dname) {
+  lock_guard<recursive_mutex> guard(lock);
+  NfsResult result = request("cd " + dname + "\r\n");
+  if(result.ok())
+    cwd_path = path_of(dname);
+  return result;
+}
+
+NfsResult NfsClient::home() {
+  lock_guard<recursive_mutex> guard(lock);
+  NfsResult result = request("home\r\n");
+  if(result.ok())
+    cwd_path = "/";
+  return result;
+}
+
+NfsResult NfsClient::rmdir(const string& dname) {
+  lock_guard<recursive_mutex> guard(lock);
+  cache_invalidate(dname);
+  return request("rmdir " + dname + "\r\n");
+}
+
+NfsResult NfsClient::ls() {
+  return request("ls\r\n");
+}
+
+NfsResult NfsClient::create(const string& fname) {
+  return request("create " + fname + "\r\n");
+}
+
+NfsResult NfsClient::append(const string& fname, const string& data) {
+  lock_guard<recursive_mutex> guard(lock);
+  cache_invalidate(fname);
+  if(!write_behind)
+    return request("append " + fname + " " + data + "\r\n");
+  if(!mounted)
+    return make_result(-1, "Not connected to a server");
+
+  //Only consecutive appends to the same file are coalesced
+  flush_stale_appends();
+  if(!wb_data.empty() && (wb_file != fname ||
+     wb_data.length() + data.length() > WB_MAX_BYTES)) {
+    NfsResult flushed = flush_appends();
+    if(!flushed.ok())
+      wb_errors.push_back(flushed);
+  }
+
+  //Buffer the data, errors are reported when the buffer is flushed
+  if(wb_data.empty()) {
+    wb_file = fname;
+    wb_since = clock::now();
+  }
+  wb_data += data;
+  if(wb_data.length() >= WB_MAX_BYTES) {
+    NfsResult flushed = flush_appends();
+    if(!flushed.ok())
+      wb_errors.push_back(flushed);
+  }
+  return make_result(200, "200 OK");
+}
+
+NfsResult NfsClient::cat(const string& fname, ostream* out) {
+  lock_guard<recursive_mutex> guard(lock);
+  NfsResult result;
+
+  //Serve from the cache while the lease holds
+  if(!cache_lookup(fname, "cat", result)) {
+    clock::time_point sent = clock::now();
+    result = request("cat " + fname + "\r\n", out, cache_on);
+    cache_fill(fname, "cat", result, sent);
+  } else if(out) {
+    *out << result.body;
+  }
+  if(out)
+    result.body.clear();
+  return result;
+}
+
+NfsResult NfsClient::get(const string& fname, ostream& out) {
+  //cat bodies end with a newline unless the file is empty
+  DropLastByte strip(&out);
+  ostream stripped(&strip);
+  return cat(fname, &stripped);
+}
+
+NfsResult NfsClient::head(const string& fname, unsigned int n, ostream* out) {
+  lock_guard<recursive_mutex> guard(lock);
+  string cmd_name = "head " + to_string(n);
+  NfsResult result;
+
+  //Serve from a cached head, or cut it out of a cached cat
+  if(cache_lookup(fname, "cat", result)) {
+    //cat bodies end with a newline unless the file is empty
+    string data = result.body;
+    if(!data.empty())
+      data.erase(data.length() - 1);
+    if(n < data.length())
+      data.erase(n);
+    result.body = data.empty() ? data : data + "\n";
+  } else if(!cache_lookup(fname, cmd_name, result)) {
+    clock::time_point sent = clock::now();
+    result = request("head " + fname + " " + to_string(n) + "\r\n", out, cache_on);
+    cache_fill(fname, cmd_name, result, sent);
+    if(out)
+      result.body.clear();
+    return result;
+  }
+  if(out) {
+    *out << result.body;
+    result.body.clear();
+  }
+  return result;
+}
+
+NfsResult NfsClient::rm(const string& fname) {
+  lock_guard<recursive_mutex> guard(lock);
+  cache_invalidate(fname);
+  return request("rm " + fname + "\r\n");
+}
+
+NfsResult NfsClient::stat(const string& name) {
+  lock_guard<recursive_mutex> guard(lock);
+  NfsResult result;
+
+  //Serve from the cache while the lease holds
+  if(!cache_lookup(name, "stat", result)) {
+    clock::time_point sent = clock::now();
+    result = request("stat " + name + "\r\n");
+    cache_fill(name, "stat", result, sent);
+  }
+  return result;
+}
+
+NfsResult NfsClient::open(const string& fname) {
+  lock_guard<recursive_mutex> guard(lock);
+  NfsResult result = request("open " + fname + "\r\n");
+  if(result.ok())
+    open_paths[atoi(result.body.c_str())] = path_of(fname);
+  return result;
+}
+
+NfsResult NfsClient::close(int fd) {
+  lock_guard<recursive_mutex> guard(lock);
+  NfsResult result = request("close " + to_string(fd) + "\r\n");
+  if(result.ok())
+    open_paths.erase(fd);
+  return result;
+}
+
+NfsResult NfsClient::read(int fd, unsigned int n, ostream* out) {
+  return request("read " + to_string(fd) + " " + to_string(n) + "\r\n", out);
+}
+
+NfsResult NfsClient::write(int fd, const string& data) {
+  lock_guard<recursive_mutex> guard(lock);
+  map<int, string>::iterator it = open_paths.find(fd);
+  if(it != open_paths.end())
+    cache_invalidate_path(it->second);
+  return request("write " + to_string(fd) + " " + data + "\r\n");
+}
+
+NfsResult NfsClient::cp(const string& src, const string& dst) {
+  return request("cp " + src + " " + dst + "\r\n");
+}
+
+NfsResult NfsClient::mv(const string& src, const string& dst) {
+  lock_guard<recursive_mutex> guard(lock);
+  cache_invalidate(src);
+  string to = !dst.empty() && dst[0] == '/' ? dst : path_of(dst);
+  while(to.length() > 1 && to[to.length() - 1] == '/')
+    to.erase(to.length() - 1);
+  cache_invalidate_path(to);
+  return request("mv " + src + " " + dst + "\r\n");
+}
+
+NfsResult NfsClient::rm_tree(const string& name) {
+  lock_guard<recursive_mutex> guard(lock);
+  cache_invalidate(name);
+  return request("rm -r " + name + "\r\n");
+}
+
+NfsResult NfsClient::cp_tree(const string& src, const string& dst) {
+  return request("cp -r " + src + " " + dst + "\r\n");
+}
+
+NfsResult NfsClient::du(const string& name) {
+  return request(name.empty() ? string("du\r\n") : "du " + name + "\r\n");
+}
+
+// Sends a raw command line, e.g. an admin command, and returns the result
+NfsResult NfsClient::command(const string& cmd_line) {
+  return request(cmd_line + "\r\n");
+}
+
+// cat of several files, spread across the connection pool and fetched
+// in parallel. Results are in the order of fnames.
+vector<NfsResult> NfsClient::cat_many(const vector<string>& fnames) {
+  lock_guard<recursive_mutex> guard(lock);
+  size_t n = fnames.size();
+  vector<NfsResult> results(n);
+  vector<char> done(n, 0);	// set once a file has been fetched
+  if(!mounted) {
+    for(size_t i = 0; i < n; i++)
+      results[i] = make_result(-1, "Not connected to a server");
+    return results;
+  }
+
+  //Buffered appends go out first, a cat may read them back
+  if(!wb_data.empty()) {
+    NfsResult flushed = flush_appends();
+    if(!flushed.ok())
+      wb_errors.push_back(flushed);
+  }
+
+  //Serve what the cache holds while the lease holds
+  for(size_t i = 0; i < n; i++)
+    done[i] = cache_lookup(fnames[i], "cat", results[i]);
+
+  //One worker per connection, connection c fetches files c, c + N, ...
+  //Pooled connections first follow the cwd of the main connection.
+  clock::time_point sent = clock::now();
+  int num_conns = pool_socks.size() + 1;
+  vector<thread> workers;
+  for(int c = 0; c < num_conns; c++) {
+    workers.push_back(thread([&, c]() {
+      int sock = (c == 0) ? cs_sock : pool_socks[c - 1];
+      if(c > 0 && !sync_cwd(c - 1))
+        return;
+      for(size_t i = c; i < n; i += num_conns) {
+        if(done[i])
+          continue;
+        results[i] = send_recv(sock, "cat " + fnames[i] + "\r\n");
+        done[i] = 1;
+      }
+    }));
+  }
+  for(size_t w = 0; w < workers.size(); w++)
+    workers[w].join();
+
+  //Files of a connection that could not follow the cwd go over the main one
+  for(size_t i = 0; i < n; i++) {
+    if(!done[i])
+      results[i] = send_recv(cs_sock, "cat " + fnames[i] + "\r\n");
+    cache_fill(fnames[i], "cat", results[i], sent);
+  }
+  return results;
+}
+
+std::future<NfsResult> NfsClient::mkdir_async(const string& dname) {
+  return async(launch::async, [=]() { return mkdir(dname); });
+}
+
+std::future<NfsResult> NfsClient::cd_async(const string& dname) {
+  return async(launch::async, [=]() { return cd(dname); });
+}
+
+std::future<NfsResult> NfsClient::home_async() {
+  return async(launch::async, [=]() { return home(); });
+}
+
+std::future<NfsResult> NfsClient::rmdir_async(const string& dname) {
+  return async(launch::async, [=]() { return rmdir(dname); });
+}
+
+std::future<NfsResult> NfsClient::ls_async() {
+  return async(launch::async, [=]() { return ls(); });
+}
+
+std::future<NfsResult> NfsClient::create_async(const string& fname) {
+  return async(launch::async, [=]() { return create(fname); });
+}
+
+std::future<NfsResult> NfsClient::append_async(const string& fname, const string& data) {
+  return async(launch::async, [=]() { return append(fname, data); });
+}
+
+std::future<NfsResult> NfsClient::cat_async(const string& fname) {
+  return async(launch::async, [=]() { return cat(fname); });
+}
+
+std::future<NfsResult> NfsClient::head_async(const string& fname, unsigned int n) {
+  return async(launch::async, [=]() { return head(fname, n); });
+}
+
+std::future<NfsResult> NfsClient::rm_async(const string& fname) {
+  return async(launch::async, [=]() { return rm(fname); });
+}
+
+std::future<NfsResult> NfsClient::stat_async(const string& name) {
+  return async(launch::async, [=]() { return stat(name); });
+}
+
+std::future<NfsResult> NfsClient::open_async(const string& fname) {
+  return async(launch::async, [=]() { return open(fname); });
+}
+
+std::future<NfsResult> NfsClient::close_async(int fd) {
+  return async(launch::async, [=]() { return close(fd); });
+}
+
+std::future<NfsResult> NfsClient::read_async(int fd, unsigned int n) {
+  return async(launch::async, [=]() { return read(fd, n); });
+}
+
+std::future<NfsResult> NfsClient::write_async(int fd, const string& data) {
+  return async(launch::async, [=]() { return write(fd, data); });
+}
+
+std::future<NfsResult> NfsClient::cp_async(const string& src, const string& dst) {
+  return async(launch::async, [=]() { return cp(src, dst); });
+}
+
+std::future<NfsResult> NfsClient::mv_async(const string& src, const string& dst) {
+  return async(launch::async, [=]() { return mv(src, dst); });
+}
+
+std::future<NfsResult> NfsClient::rm_tree_async(const string& name) {
+  return async(launch::async, [=]() { return rm_tree(name); });
+}
+
+std::future<NfsResult> NfsClient::cp_tree_async(const string& src, const string& dst) {
+  return async(launch::async, [=]() { return cp_tree(src, dst); });
+}
+
+std::future<NfsResult> NfsClient::du_async(const string& name) {
+  return async(launch::async, [=]() { return du(name); });
+}
+
+// Sends the buffered appends as one append request. Returns the result
+// of that request, or a 200 result if nothing was buffered.
+NfsResult NfsClient::flush_appends() {
+  lock_guard<recursive_mutex> guard(lock);
+  if(wb_data.empty())
+    return make_result(200, "200 OK");
+  string cmd = "append " + wb_file + " " + wb_data + "\r\n";
+  wb_data.clear();
+  return send_recv(cs_sock, cmd);
+}
+
+// Sends the buffered appends if they have waited for WB_MAX_MS
+void NfsClient::flush_stale_appends() {
+  if(!wb_data.empty() && clock::now() >= flush_deadline()) {
+    NfsResult flushed = flush_appends();
+    if(!flushed.ok())
+      wb_errors.push_back(flushed);
+  }
+}
+
+// Time at which the buffered appends are due to be sent, or
+// time_point::max() if nothing is buffered
+chrono::steady_clock::time_point NfsClient::flush_deadline() {
+  lock_guard<recursive_mutex> guard(lock);
+  if(wb_data.empty())
+    return clock::time_point::max();
+  return wb_since + chrono::milliseconds(WB_MAX_MS);
+}
+
+// Errors of buffered appends that were sent before another request.
+// Returns and clears them.
+vector<NfsResult> NfsClient::take_append_errors() {
+  lock_guard<recursive_mutex> guard(lock);
+  vector<NfsResult> errors;
+  errors.swap(wb_errors);
+  return errors;
+}
+
+// Moves pooled connection conn to the cwd of the main connection.
+// Returns false if the directory could not be reached.
+bool NfsClient::sync_cwd(int conn) {
+  if(pool_cwd[conn] == cwd_path)
+    return true;
+
+  //Walk down from the root one directory at a time
+  pool_cwd[conn] = "";
+  if(!send_recv(pool_socks[conn], "home\r\n").ok())
+    return false;
+  istringstream path(cwd_path);
+  string dname;
+  while(getline(path, dname, '/')) {
+    if(dname.empty())
+      continue;
+    if(!send_recv(pool_socks[conn], "cd " + dname + "\r\n").ok())
+      return false;
+  }
+  pool_cwd[conn] = cwd_path;
+  return true;
+}
+
+// Returns the path of name in the cwd
+string NfsClient::path_of(const string& name) {
+  return (cwd_path == "/" ? "/" : cwd_path + "/") + name;
+}
+
+// Looks up the command on file name in the cache. Returns true and
+// the cached response if there is an entry whose lease has not run out.
+bool NfsClient::cache_lookup(const string& name, const string& cmd_name,
+                             NfsResult& result) {
+  if(!cache_on)
+    return false;
+  map<string, CacheEntry>::iterator it = cache.find(path_of(name) + '\n' + cmd_name);
+  if(it == cache.end())
+    return false;
+  if(it->second.expiry <= clock::now()) {
+    cache.erase(it);
+    return false;
+  }
+  result = make_result(200, "200 OK");
+  result.body = it->second.body;
+  result.cached = true;
+  return true;
+}
+
+// Caches the body of result for the command on file name if the
+// response carried a lease. sent is when the request went out, the
+// lease counts from there.
+void NfsClient::cache_fill(const string& name, const string& cmd_name,
+                           const NfsResult& result, clock::time_point sent) {
+  if(!cache_on || !result.ok() || result.lease <= 0)
+    return;
+  CacheEntry entry = {result.body, sent + chrono::milliseconds(result.lease)};
+  cache[path_of(name) + '\n' + cmd_name] = entry;
+}
+
+// Drops cached results for file name in the cwd, and for everything
+// below it if it is a directory
+void NfsClient::cache_invalidate(const string& name) {
+  cache_invalidate_path(path_of(name));
+}
+
+// Drops cached results for the file or directory at path, and for
+// everything below it
+void NfsClient::cache_invalidate_path(const string& path) {
+  map<string, CacheEntry>::iterator it = cache.lower_bound(path);
+  while(it != cache.end() && it->first.compare(0, path.length(), path) == 0) {
+    char next = it->first[path.length()];
+    if(next == '\n' || next == '/')
+      it = cache.erase(it);
+    else
+      it++;
+  }
+}
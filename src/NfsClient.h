@@ -0,0 +1,230 @@
+// CPSC 3500: Network File System client
+// Implements the client side of the protocol as a library: every request
+// returns its status, payload and latency instead of printing them, so the
+// shell, benchmarks and other programs can all drive the server with it.
+
+#ifndef NFSCLIENT_H
+#define NFSCLIENT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <netdb.h>
+
+// Result of one request
+struct NfsResult {
+  int code;			// response code, 200 on success, -1 if the connection failed
+  std::string status;		// status line, e.g. "503 File does not exist"
+  std::string body;		// message body, empty if it was streamed to an ostream
+  int lease;			// read lease granted with the response in ms, 0 if none
+  bool cached;			// true if served from the client cache
+  std::chrono::microseconds latency; // time from sending the request to the last byte
+
+  // true if the request succeeded
+  bool ok() const { return code == 200; }
+};
+
+class NfsClient {
+
+  public:
+    NfsClient();
+
+    // Closes the connections if still mounted
+    ~NfsClient();
+
+    // Cache cat/head/stat results under server read leases.
+    // Must be called before mount.
+    void enable_cache();
+
+    // Coalesce consecutive appends to the same file into one request.
+    void enable_write_behind();
+
+    // Opens n connections to the server, independent requests are spread
+    // across them. Must be called before mount.
+    void set_pool_size(int n);
+
+    // Connects to the server at fs_loc, in the format of server:port.
+    // Returns a result with code 200 on success and -1 otherwise.
+    NfsResult mount(const std::string& fs_loc);
+
+    // Sends buffered appends and closes the connections
+    void unmount();
+
+    // true if connected to the server
+    bool is_mounted() const;
+
+    // path of the current directory on the server
+    std::string cwd();
+
+    // Requests. The body of cat and head is streamed to out if given,
+    // otherwise it is returned in the result.
+    NfsResult mkdir(const std::string& dname);
+    NfsResult cd(const std::string& dname);
+    NfsResult home();
+    NfsResult rmdir(const std::string& dname);
+    NfsResult ls();
+    NfsResult create(const std::string& fname);
+    NfsResult append(const std::string& fname, const std::string& data);
+    NfsResult cat(const std::string& fname, std::ostream* out = NULL);
+    NfsResult head(const std::string& fname, unsigned int n, std::ostream* out = NULL);
+    // Saves the data of the file to out, without the newline cat adds
+    NfsResult get(const std::string& fname, std::ostream& out);
+    NfsResult rm(const std::string& fname);
+    NfsResult stat(const std::string& name);
+
+    // Open file handles. The body of open is the handle, read and write
+    // use it to reach the file without looking it up by name. write
+    // appends, and the body of read is streamed to out if given.
+    NfsResult open(const std::string& fname);
+    NfsResult close(int fd);
+    NfsResult read(int fd, unsigned int n, std::ostream* out = NULL);
+    NfsResult write(int fd, const std::string& data);
+
+    // Copies and moves without the data going over the network. cp copies
+    // a file to a new name in the cwd, sharing its data blocks on the
+    // server. mv renames an entry of the cwd, or moves it into the
+    // directory at dst, relative to the cwd or from the root with a
+    // leading /.
+    NfsResult cp(const std::string& src, const std::string& dst);
+    NfsResult mv(const std::string& src, const std::string& dst);
+
+    // Whole subtrees in one request each. rm_tree deletes a directory with
+    // everything in it, cp_tree copies one to a new name in the cwd, and
+    // du reports what is under a directory, the cwd if name is empty.
+    // A data file works in place of the directory in each.
+    NfsResult rm_tree(const std::string& name);
+    NfsResult cp_tree(const std::string& src, const std::string& dst);
+    NfsResult du(const std::string& name = "");
+
+    // Sends a raw command line, e.g. an admin command, and returns the result
+    NfsResult command(const std::string& cmd_line);
+
+    // cat of several files, spread across the connection pool and fetched
+    // in parallel. Results are in the order of fnames.
+    std::vector<NfsResult> cat_many(const std::vector<std::string>& fnames);
+
+    // Async variants, run on their own thread. Requests of one client are
+    // still sent one at a time over the main connection.
+    std::future<NfsResult> mkdir_async(const std::string& dname);
+    std::future<NfsResult> cd_async(const std::string& dname);
+    std::future<NfsResult> home_async();
+    std::future<NfsResult> rmdir_async(const std::string& dname);
+    std::future<NfsResult> ls_async();
+    std::future<NfsResult> create_async(const std::string& fname);
+    std::future<NfsResult> append_async(const std::string& fname, const std::string& data);
+    std::future<NfsResult> cat_async(const std::string& fname);
+    std::future<NfsResult> head_async(const std::string& fname, unsigned int n);
+    std::future<NfsResult> rm_async(const std::string& fname);
+    std::future<NfsResult> stat_async(const std::string& name);
+    std::future<NfsResult> open_async(const std::string& fname);
+    std::future<NfsResult> close_async(int fd);
+    std::future<NfsResult> read_async(int fd, unsigned int n);
+    std::future<NfsResult> write_async(int fd, const std::string& data);
+    std::future<NfsResult> cp_async(const std::string& src, const std::string& dst);
+    std::future<NfsResult> mv_async(const std::string& src, const std::string& dst);
+    std::future<NfsResult> rm_tree_async(const std::string& name);
+    std::future<NfsResult> cp_tree_async(const std::string& src, const std::string& dst);
+    std::future<NfsResult> du_async(const std::string& name = "");
+
+    // Sends the buffered appends as one append request. Returns the result
+    // of that request, or a 200 result if nothing was buffered.
+    NfsResult flush_appends();
+
+    // Time at which the buffered appends are due to be sent, or
+    // time_point::max() if nothing is buffered
+    std::chrono::steady_clock::time_point flush_deadline();
+
+    // Errors of buffered appends that were sent before another request.
+    // Returns and clears them.
+    std::vector<NfsResult> take_append_errors();
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    int cs_sock = -1; //socket to the network file system server
+
+    bool mounted = false; //true if connected to the server
+
+    std::recursive_mutex lock; //serializes requests and guards client state
+
+    std::string cwd_path = "/"; //path of the current directory on the server
+
+    int pool_size = 1; //number of connections to open to the server
+
+    std::vector<int> pool_socks; //connections opened besides cs_sock
+
+    std::vector<std::string> pool_cwd; //cwd of each pooled connection, "" if unknown
+
+    bool cache_on = false; //true if cat/head/stat results are cached
+
+    // cached response body, valid until the read lease runs out
+    struct CacheEntry {
+      std::string body;		// response body
+      clock::time_point expiry;	// lease expiry
+    };
+
+    // client cache keyed by path + '\n' + command, e.g. "/dir/f\nhead 5"
+    std::map<std::string, CacheEntry> cache;
+
+    // path of the file behind each open handle, so writes drop its cached results
+    std::map<int, std::string> open_paths;
+
+    bool write_behind = false; //true if appends are buffered
+
+    std::string wb_file; //file in the cwd the buffered appends go to
+
+    std::string wb_data; //buffered append data, empty if nothing is pending
+
+    clock::time_point wb_since; //time of first buffered append
+
+    std::vector<NfsResult> wb_errors; //errors of flushes done before other requests
+
+    // Opens a socket connected to the first reachable address in servinfo.
+    // Returns the socket, or -1 if no address could be reached.
+    int connect_server(addrinfo* servinfo);
+
+    // Sends the command line over socket sock and receives the response.
+    // The body is streamed to out if given, and kept in the result if out
+    // is not given or keep_body is set.
+    NfsResult send_recv(int sock, const std::string& cmd, std::ostream* out = NULL,
+                        bool keep_body = false);
+
+    // Sends the command line over the main connection, flushing buffered
+    // appends first
+    NfsResult request(const std::string& cmd, std::ostream* out = NULL,
+                      bool keep_body = false);
+
+    // Sends the buffered appends if they have waited for WB_MAX_MS
+    void flush_stale_appends();
+
+    // Moves pooled connection conn to the cwd of the main connection.
+    // Returns false if the directory could not be reached.
+    bool sync_cwd(int conn);
+
+    // Returns the path of name in the cwd
+    std::string path_of(const std::string& name);
+
+    // Looks up the command on file name in the cache. Returns true and
+    // the cached response if there is an entry whose lease has not run out.
+    bool cache_lookup(const std::string& name, const std::string& cmd_name,
+                      NfsResult& result);
+
+    // Caches the body of result for the command on file name if the
+    // response carried a lease. sent is when the request went out.
+    void cache_fill(const std::string& name, const std::string& cmd_name,
+                    const NfsResult& result, clock::time_point sent);
+
+    // Drops cached results for file name in the cwd, and for everything
+    // below it if it is a directory
+    void cache_invalidate(const std::string& name);
+
+    // Drops cached results for the file or directory at path, and for
+    // everything below it
+    void cache_invalidate_path(const std::string& path);
+};
+
+#endif
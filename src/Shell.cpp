@@ -7,6 +7,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <poll.h>
 using namespace std;
 
 #include "Shell.h"
@@ -15,242 +16,226 @@ static const string PROMPT_STRING = "NFS> ";	// shell prompt
 
 // Mount the network file system with server name and port number in the format of server:port
 void Shell::mountNFS(string fs_loc) {
-	//create the socket cs_sock and connect it to the server and port specified in fs_loc
+	//connect the client to the server and port specified in fs_loc
 	//if all the above operations are completed successfully, set is_mounted to true
-
-  //Parse server:port
-  char* cstring = (char*)fs_loc.c_str();
-  char* token = strtok(cstring, ":");
-  char* tokens[2] = {0};
-  int i = 0;
-  while(token) {
-    tokens[i++] = token;
-    token = strtok(NULL, ":");
-  }
-  if(i != 2) {
-    cerr << "Invalid command line" << endl;
+  NfsResult result = client.mount(fs_loc);
+  if(!result.ok()) {
+    cerr << result.status << endl;
     cerr << "Usage (one of the following): " << endl;
-    cerr << "./nfsclient server:port" << endl;
-    cerr << "./nfsclient -s <script-name> server:port" << endl;
+    cerr << "./nfsclient [-c] [-w] [-p n] server:port" << endl;
+    cerr << "./nfsclient [-c] [-w] [-p n] -s <script-name> server:port" << endl;
     exit(1);
   }
+  is_mounted = true;
+}
 
-  //Get address information
-  addrinfo hints, *servinfo, *p;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  int rv;
-  if((rv = getaddrinfo(tokens[0], tokens[1], &hints, &servinfo)) != 0) {
-      fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-      exit(1);
-  }
+// Cache cat/head/stat results on the client under server read leases.
+void Shell::enable_cache() {
+  client.enable_cache();
+}
 
-  //Create socket and attempt to connection with socket
-  for(p = servinfo; p != NULL; p = p->ai_next) {
-      
-      if((cs_sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1){
-        perror("socket");
-        continue;
-      }
-      if(connect(cs_sock, p->ai_addr, p->ai_addrlen) == -1) {
-        perror("connect");
-        close(cs_sock);
-        continue;
-      }
-      break; //End loop once conn
-  }
-  freeaddrinfo(servinfo); 
-  is_mounted = true;
+// Coalesce consecutive appends to the same file into one request.
+void Shell::enable_write_behind() {
+  client.enable_write_behind();
+}
+
+// Opens n connections to the server, independent requests are spread
+// across them. Must be called before mountNFS.
+void Shell::set_pool_size(int n) {
+  client.set_pool_size(n);
 }
 
 // Unmount the network file system if it was mounted
 void Shell::unmountNFS() {
-	// close the socket if it was mounted
-  close(cs_sock);
+	// close the connections if it was mounted
+  client.unmount();
+  is_mounted = false;
 }
 
-// Sends the command to the server, receives response and displays it to stdout
-void Shell::send_recv(string& cmd, string cmd_name) {
-  
-  //Send
-  char* p = (char*)cmd.c_str();
-  int bytes_sent = 0;
-  int msg_len = strlen(p);
-  while(bytes_sent < msg_len) {
-    int x = write(cs_sock, (void*)p, msg_len - bytes_sent);
-    if(x == -1 || x == 0) {
-      perror("write");
-      unmountNFS();
-      exit(1); //CHANGE THIS LATER IT SHOULD NOT EXIT WITHOUT CLOSING THE LISTENING SOCKET
-    }
-    p += x;
-    bytes_sent += x;
+// Displays the result of a request to stdout: the body if there is one,
+// the status line on an error, and success otherwise. Streamed bodies of
+// cat and head are already on stdout. A lost connection ends the shell.
+void Shell::display(const NfsResult& result, string cmd_name) {
+  if(result.code == -1) {
+    cerr << result.status << endl;
+    unmountNFS();
+    exit(1);
   }
-
-  //Receive
-  char msg[8192]; //Potential max file size < 8KB
-
-  //If 200 OK is found
-  char* start = msg; //Start of msg (after headers)
-  bool succ = false; //Flag if 200 OK is found
-  int mbody_len = 0; //Msg body len for conditional printing at the very end
-
-  char* ptr = (char*)msg;
-  int bytes_recv = 0; 
-  int CHUNK_SIZE = 1024;
-  msg_len = CHUNK_SIZE; //To be updated when length is found
-  char c_len[6] = {0}; //5 digits for 7kb file + msg header
-  bool len_header = false; //Flag to find length header
-
-  while(bytes_recv < msg_len) {
-
-      int x = read(cs_sock, (void*)ptr, msg_len - bytes_recv);
-      if(x == -1 || x == 0) {
-          perror("read");
-          unmountNFS();
-          exit(1);
-      }
-      ptr += x;
-      bytes_recv += x;
-      
-      //Check for message length
-      if(!len_header) {
-        //Find first header line
-        int i = 1;
-        bool found = false;
-        while(bytes_recv > 0 && i < CHUNK_SIZE) {
-          if(msg[i-1] == '\r' && msg[i] == '\n') {
-            found = true;
-            break;
-          }
-          i++;
-        }
-        succ = strstr(msg, "200 OK") != NULL;
-        bool lfound = false;
-        if(!succ) { //If no success cut message off and just print header
-          msg[i-1] = '\0'; //cut off \r\n from msg
-          msg_len = 0;
-        } else {
-
-          //Get to beginning of Length:X line, and read until \r\n
-          if(found) {
-            i += 8;
-            int j = 0;
-            while(i < CHUNK_SIZE - 1) {
-              if(msg[i] != '\r' && msg[i+1] != '\n') {
-                c_len[j] = msg[i];
-              } else {
-                lfound = true;
-                mbody_len = atoi(c_len);
-                i+=2; //Get past \r\n
-                break;
-              }
-              j++;
-              i++;
-            }
-          }
-          
-          //Update message length based on amt of bytes read
-          if(lfound) {
-            //Check for next end of line (\r\n)
-            if(i < CHUNK_SIZE-1 && msg[i] == '\r' && msg[i+1] == '\n') {
-              i += 2; //i is now equal to header length
-              //msg body len + header len = msg len
-              msg_len = mbody_len + i;
-
-              //Change start to the message body
-              start = msg + i;
-            }
-            //Update since the two message headers are found
-            len_header = true;
-          }
-        }
-      }
-  } 
-  *ptr = '\0'; //Prevent garbage from being printed for smaller prev msgs
-  //If the msg body len is > 0 or the msg was an error print buffer or cat/head print msg
-  if(mbody_len || !succ || cmd_name == "cat" || cmd_name == "head")
-    cout << start << endl;
+  if(!result.ok())
+    cout << result.status << endl;
+  else if(cmd_name == "cat" || cmd_name == "head" || cmd_name == "read")
+    cout << result.body << endl;
+  else if(!result.body.empty())
+    cout << result.body << endl;
   else
     cout << "success\n";
 }
 
+// Displays the errors of buffered appends that were sent since the last command
+void Shell::display_append_errors() {
+  vector<NfsResult> errors = client.take_append_errors();
+  for(size_t i = 0; i < errors.size(); i++)
+    display(errors[i], "append");
+}
+
+// Sends the buffered appends, only an error status gets printed
+void Shell::flush_appends() {
+  NfsResult result = client.flush_appends();
+  if(!result.ok())
+    display(result, "append");
+}
+
 // Remote procedure call on mkdir
 void Shell::mkdir_rpc(string dname) {
-  // to implement
-  string cmd = "mkdir " + dname + "\r\n";
-  send_recv(cmd, "mkdir");
+  display(client.mkdir(dname), "mkdir");
 }
 
 // Remote procedure call on cd
 void Shell::cd_rpc(string dname) {
-  // to implement
-  string cmd = "cd " + dname + "\r\n";
-  send_recv(cmd, "cd");
+  display(client.cd(dname), "cd");
 }
 
 // Remote procedure call on home
 void Shell::home_rpc() {
-  // to implement
-  string cmd = "home\r\n";
-  send_recv(cmd, "home");
+  display(client.home(), "home");
 }
 
 // Remote procedure call on rmdir
 void Shell::rmdir_rpc(string dname) {
-  // to implement
-  string cmd = "rmdir " + dname + "\r\n";
-  send_recv(cmd, "rmdir");
+  display(client.rmdir(dname), "rmdir");
 }
 
 // Remote procedure call on ls
 void Shell::ls_rpc() {
-  // to implement
-  string cmd = "ls\r\n";
-  send_recv(cmd, "ls");
+  display(client.ls(), "ls");
 }
 
 // Remote procedure call on create
 void Shell::create_rpc(string fname) {
-  // to implement
-  string cmd = "create " + fname + "\r\n";
-  send_recv(cmd, "create");
+  display(client.create(fname), "create");
 }
 
 // Remote procedure call on append
 void Shell::append_rpc(string fname, string data) {
-  // to implement
-  string cmd = "append " + fname + " " + data + "\r\n";
-  send_recv(cmd, "append");
+  NfsResult result = client.append(fname, data);
+  display_append_errors();
+  display(result, "append");
 }
 
 // Remote procesure call on cat
 void Shell::cat_rpc(string fname) {
-  // to implement
-  string cmd = "cat " + fname + "\r\n";
-  send_recv(cmd, "cat");
+  display(client.cat(fname, &cout), "cat");
+}
+
+// Remote procedure call on cat for several files. The files are spread
+// across the connection pool and fetched in parallel, then displayed in order.
+void Shell::cat_many(vector<string> fnames) {
+  vector<NfsResult> results = client.cat_many(fnames);
+  for(size_t i = 0; i < results.size(); i++)
+    display(results[i], "cat");
+}
+
+// Remote procedure call on cat that saves the file to a local file
+void Shell::get_rpc(string fname, string local_name) {
+  ofstream outfile(local_name.c_str(), ios::out | ios::binary | ios::trunc);
+  if(outfile.fail()) {
+    cerr << "Could not open local file " << local_name << endl;
+    return;
+  }
+  NfsResult result = client.get(fname, outfile);
+  display(result, "get");
 }
 
 // Remote procedure call on head
 void Shell::head_rpc(string fname, int n) {
-  // to implement
-  string cmd = "head " + fname + " " + to_string(n) + "\r\n";
-  send_recv(cmd, "head");
+  display(client.head(fname, n, &cout), "head");
+}
+
+// Remote procedure call on open, displays the handle
+void Shell::open_rpc(string fname) {
+  display(client.open(fname), "open");
+}
+
+// Remote procedure call on close
+void Shell::close_rpc(int fd) {
+  display(client.close(fd), "close");
+}
+
+// Remote procedure call on read
+void Shell::read_rpc(int fd, int n) {
+  display(client.read(fd, n, &cout), "read");
+}
+
+// Remote procedure call on write
+void Shell::write_rpc(int fd, string data) {
+  display(client.write(fd, data), "write");
 }
 
 // Remote procedure call on rm
 void Shell::rm_rpc(string fname) {
-  // to implement
-  string cmd = "rm " + fname + "\r\n";
-  send_recv(cmd, "rm");
+  display(client.rm(fname), "rm");
 }
 
 // Remote procedure call on stat
 void Shell::stat_rpc(string fname) {
-  // to implement
-  string cmd = "stat " + fname + "\r\n";
-  send_recv(cmd, "stat");
+  display(client.stat(fname), "stat");
+}
+
+// Remote procedure call on cp
+void Shell::cp_rpc(string src, string dst) {
+  display(client.cp(src, dst), "cp");
+}
+
+// Remote procedure call on mv
+void Shell::mv_rpc(string src, string dst) {
+  display(client.mv(src, dst), "mv");
+}
+
+// Remote procedure call on rm -r
+void Shell::rm_tree_rpc(string name) {
+  display(client.rm_tree(name), "rm -r");
+}
+
+// Remote procedure call on cp -r
+void Shell::cp_tree_rpc(string src, string dst) {
+  display(client.cp_tree(src, dst), "cp -r");
+}
+
+// Remote procedure call on du, of the cwd if name is empty
+void Shell::du_rpc(string name) {
+  display(client.du(name), "du");
+}
+
+// Remote procedure call on snapshot, freezing the whole tree as
+// /.snap/name
+void Shell::snapshot_rpc(string name) {
+  display(client.command("snapshot " + name), "snapshot");
+}
+
+// Remote procedure call on stats, the server's counters and latencies
+void Shell::stats_rpc() {
+  display(client.command("stats"), "stats");
+}
+
+// Remote procedure call on trace: "on" and "off" switch server tracing,
+// anything else is a local file the Chrome trace JSON is saved to
+void Shell::trace_rpc(string arg) {
+  if (arg == "on" || arg == "off") {
+    display(client.command("trace " + arg), "trace");
+    return;
+  }
+  NfsResult result = client.command("trace dump");
+  if (!result.ok()) {
+    display(result, "trace");
+    return;
+  }
+  ofstream out(arg.c_str());
+  out << result.body;
+  if (!out) {
+    cerr << "Could not write " << arg << endl;
+    return;
+  }
+  cout << "success" << endl;
 }
 
 // Executes the shell until the user quits.
@@ -266,7 +251,20 @@ void Shell::run()
 
     // print prompt and get command line
     string command_str;
-    cout << PROMPT_STRING;
+    cout << PROMPT_STRING << flush;
+
+    // while appends are buffered, wait for input only until they are due
+    chrono::steady_clock::time_point due;
+    while ((due = client.flush_deadline()) != chrono::steady_clock::time_point::max() &&
+           cin.rdbuf()->in_avail() <= 0) {
+      chrono::steady_clock::duration left = due - chrono::steady_clock::now();
+      int timeout = chrono::duration_cast<chrono::milliseconds>(left).count();
+      struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+      if (timeout <= 0 || poll(&pfd, 1, timeout) == 0)
+        flush_appends();
+      else
+        break;
+    }
     getline(cin, command_str);
 
     // execute the command
@@ -274,6 +272,7 @@ void Shell::run()
   }
 
   // unmount the file system
+  flush_appends();
   unmountNFS();
 }
 
@@ -302,6 +301,7 @@ void Shell::run_script(char *file_name)
   }
 
   // clean up
+  flush_appends();
   unmountNFS();
   infile.close();
 }
@@ -313,6 +313,10 @@ bool Shell::execute_command(string command_str)
   // parse the command line
   struct Command command = parse_command(command_str);
 
+  // buffered appends go out before any other command
+  if (command.name != "append")
+    flush_appends();
+
   // look for the matching command
   if (command.name == "") {
     return false;
@@ -339,7 +343,15 @@ bool Shell::execute_command(string command_str)
     append_rpc(command.file_name, command.append_data);
   }
   else if (command.name == "cat") {
-    cat_rpc(command.file_name);
+    if (command.more_files.empty()) {
+      cat_rpc(command.file_name);
+    } else {
+      command.more_files.insert(command.more_files.begin(), command.file_name);
+      cat_many(command.more_files);
+    }
+  }
+  else if (command.name == "get") {
+    get_rpc(command.file_name, command.append_data);
   }
   else if (command.name == "head") {
     errno = 0;
@@ -355,9 +367,53 @@ bool Shell::execute_command(string command_str)
   else if (command.name == "rm") {
     rm_rpc(command.file_name);
   }
+  else if (command.name == "open") {
+    open_rpc(command.file_name);
+  }
+  else if (command.name == "close") {
+    close_rpc(atoi(command.file_name.c_str()));
+  }
+  else if (command.name == "read") {
+    errno = 0;
+    unsigned long n = strtoul(command.append_data.c_str(), NULL, 0);
+    if (0 == errno) {
+      read_rpc(atoi(command.file_name.c_str()), n);
+    } else {
+      cerr << "Invalid command line: " << command.append_data;
+      cerr << " is not a valid number of bytes" << endl;
+      return false;
+    }
+  }
+  else if (command.name == "write") {
+    write_rpc(atoi(command.file_name.c_str()), command.append_data);
+  }
   else if (command.name == "stat") {
     stat_rpc(command.file_name);
   }
+  else if (command.name == "cp") {
+    cp_rpc(command.file_name, command.append_data);
+  }
+  else if (command.name == "mv") {
+    mv_rpc(command.file_name, command.append_data);
+  }
+  else if (command.name == "rm -r") {
+    rm_tree_rpc(command.file_name);
+  }
+  else if (command.name == "cp -r") {
+    cp_tree_rpc(command.file_name, command.append_data);
+  }
+  else if (command.name == "du") {
+    du_rpc(command.file_name);
+  }
+  else if (command.name == "snapshot") {
+    snapshot_rpc(command.file_name);
+  }
+  else if (command.name == "stats") {
+    stats_rpc();
+  }
+  else if (command.name == "trace") {
+    trace_rpc(command.file_name);
+  }
   else if (command.name == "quit") {
     return true;
   }
@@ -370,19 +426,19 @@ bool Shell::execute_command(string command_str)
 Shell::Command Shell::parse_command(string command_str)
 {
   // empty command struct returned for errors
-  struct Command empty = {"", "", ""};
+  struct Command empty;
 
   // grab each of the tokens (if they exist)
   struct Command command;
   istringstream ss(command_str);
   int num_tokens = 0;
+  string junk;
   if (ss >> command.name) {
     num_tokens++;
     if (ss >> command.file_name) {
       num_tokens++;
       if (ss >> command.append_data) {
         num_tokens++;
-        string junk;
         if (ss >> junk) {
           num_tokens++;
         }
@@ -390,6 +446,30 @@ Shell::Command Shell::parse_command(string command_str)
     }
   }
 
+  // cat takes any number of files, the rest are fetched in parallel
+  if (command.name == "cat" && num_tokens > 2) {
+    command.more_files.push_back(command.append_data);
+    command.append_data = "";
+    if (num_tokens > 3) {
+      command.more_files.push_back(junk);
+      while (ss >> junk) {
+        command.more_files.push_back(junk);
+      }
+    }
+    num_tokens = 2;
+  }
+
+  // rm -r and cp -r work on whole subtrees, the flag becomes part of the name
+  if ((command.name == "rm" || command.name == "cp") && command.file_name == "-r") {
+    command.name += " -r";
+    command.file_name = command.append_data;
+    command.append_data = junk;
+    num_tokens--;
+    if (num_tokens == 3 && ss >> junk) {
+      num_tokens++;
+    }
+  }
+
   // Check for empty command line
   if (num_tokens == 0) {
     return empty;
@@ -398,6 +478,7 @@ Shell::Command Shell::parse_command(string command_str)
   // Check for invalid command lines
   if (command.name == "ls" ||
       command.name == "home" ||
+      command.name == "stats" ||
       command.name == "quit")
   {
     if (num_tokens != 1) {
@@ -412,7 +493,11 @@ Shell::Command Shell::parse_command(string command_str)
       command.name == "create"||
       command.name == "cat"   ||
       command.name == "rm"    ||
-      command.name == "stat")
+      command.name == "rm -r" ||
+      command.name == "stat"  ||
+      command.name == "open"  ||
+      command.name == "close" ||
+      command.name == "snapshot" || command.name == "trace")
   {
     if (num_tokens != 2) {
       cerr << "Invalid command line: " << command.name;
@@ -420,7 +505,10 @@ Shell::Command Shell::parse_command(string command_str)
       return empty;
     }
   }
-  else if (command.name == "append" || command.name == "head")
+  else if (command.name == "append" || command.name == "head" ||
+      command.name == "get"    || command.name == "read" ||
+      command.name == "write"  || command.name == "cp"   ||
+      command.name == "cp -r"  || command.name == "mv")
   {
     if (num_tokens != 3) {
       cerr << "Invalid command line: " << command.name;
@@ -428,6 +516,13 @@ Shell::Command Shell::parse_command(string command_str)
       return empty;
     }
   }
+  else if (command.name == "du") {
+    if (num_tokens > 2) {
+      cerr << "Invalid command line: " << command.name;
+      cerr << " has improper number of arguments" << endl;
+      return empty;
+    }
+  }
   else {
     cerr << "Invalid command line: " << command.name;
     cerr << " is not a command" << endl; 
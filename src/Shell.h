@@ -5,17 +5,22 @@
 #define SHELL_H
 
 #include <string>
+#include <vector>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
 
+#include "NfsClient.h"
+
 // Shell
+// A thin command line frontend over NfsClient: it parses commands, issues
+// them through the client and displays the results.
 class Shell {
 
   public:
-    //constructor, do not change it!!
-    Shell() : cs_sock(-1), is_mounted(false) {   
+    //constructor
+    Shell() : is_mounted(false) {   
     }
 
     // Mount a network file system located in host:port, set is_mounted = true if success
@@ -30,9 +35,20 @@ class Shell {
     // Execute a script.
     void run_script(char *file_name);
 
+    // Cache cat/head/stat results on the client under server read leases.
+    // Must be called before mountNFS.
+    void enable_cache();
+
+    // Coalesce consecutive appends to the same file into one request.
+    void enable_write_behind();
+
+    // Opens n connections to the server, independent requests are spread
+    // across them. Must be called before mountNFS.
+    void set_pool_size(int n);
+
   private:
     
-    int cs_sock; //socket to the network file system server
+    NfsClient client; //client connected to the network file system server
 
     bool is_mounted; //true if the network file system is mounted, false otherise
 
@@ -42,6 +58,7 @@ class Shell {
       string name;		// name of command
       string file_name;		// name of file
       string append_data;	// append data (append only)
+      vector<string> more_files; // further files (cat only)
     };
 
     // Executes the command. Returns true for quit and false otherwise.
@@ -75,17 +92,69 @@ class Shell {
     // Remote procesure call on cat
     void cat_rpc(string fname);
 
+    // Remote procedure call on cat for several files. The files are spread
+    // across the connection pool and fetched in parallel.
+    void cat_many(vector<string> fnames);
+
+    // Remote procedure call on cat that saves the file to a local file
+    void get_rpc(string fname, string local_name);
+
     // Remote procedure call on head
     void head_rpc(string fname, int n);
 
+    // Remote procedure call on open, displays the handle
+    void open_rpc(string fname);
+
+    // Remote procedure call on close
+    void close_rpc(int fd);
+
+    // Remote procedure call on read
+    void read_rpc(int fd, int n);
+
+    // Remote procedure call on write
+    void write_rpc(int fd, string data);
+
     // Remote procedure call on rm
     void rm_rpc(string fname);
 
     // Remote procedure call on stat
     void stat_rpc(string fname);
 
-    // Sends the command to the server, receives response and displays it to stdout
-    void send_recv(string& cmd, string cmd_name);
+    // Remote procedure call on cp
+    void cp_rpc(string src, string dst);
+
+    // Remote procedure call on mv
+    void mv_rpc(string src, string dst);
+
+    // Remote procedure call on rm -r
+    void rm_tree_rpc(string name);
+
+    // Remote procedure call on cp -r
+    void cp_tree_rpc(string src, string dst);
+
+    // Remote procedure call on du, of the cwd if name is empty
+    void du_rpc(string name);
+
+    // Remote procedure call on snapshot, freezing the whole tree as
+    // /.snap/name
+    void snapshot_rpc(string name);
+
+    // Remote procedure call on stats, the server's counters and latencies
+    void stats_rpc();
+
+    // Remote procedure call on trace: "on" and "off" switch server tracing,
+    // anything else is a local file the Chrome trace JSON is saved to
+    void trace_rpc(string arg);
+
+    // Displays the result of a request to stdout: the body if there is one,
+    // the status line on an error, and success otherwise
+    void display(const NfsResult& result, string cmd_name);
+
+    // Displays the errors of buffered appends that were sent since the last command
+    void display_append_errors();
+
+    // Sends the buffered appends, only an error status gets printed
+    void flush_appends();
 };
 
 #endif
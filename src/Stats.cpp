@@ -0,0 +1,152 @@
+// CPSC 3500: Server statistics
+// Per-operation counters and latency histograms. Recording is lock-free:
+// every counter is a relaxed atomic, and the work done for the request a
+// thread is serving is tallied in thread-local counters first.
+
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+using namespace std;
+
+#include "Stats.h"
+
+thread_local RequestCounters request_counters;
+
+ServerStats server_stats;
+
+static const char* OPCODE_NAMES[NUM_OPCODES] = {
+  "mkdir", "cd", "home", "rmdir", "ls", "create", "append",
+  "cat", "head", "rm", "stat", "open", "close", "read", "write",
+  "cp", "mv", "du", "snapshot", "lease", "stats", "trace", "other"
+};
+
+// Returns the opcode for the command name at the start of the command line
+Opcode opcode_of(const char *command) {
+  size_t len = strcspn(command, " \r\n");
+  for(int op = 0; op < OP_OTHER; op++) {
+    if(strlen(OPCODE_NAMES[op]) == len && strncmp(command, OPCODE_NAMES[op], len) == 0)
+      return (Opcode) op;
+  }
+  return OP_OTHER;
+}
+
+// Returns the command name of op
+const char* opcode_name(Opcode op) {
+  return OPCODE_NAMES[op];
+}
+
+Histogram::Histogram() : total(0), largest(0) {
+  for(int i = 0; i < NUM_BUCKETS; i++)
+    buckets[i] = 0;
+}
+
+// Adds one value
+void Histogram::record(uint64_t value) {
+  buckets[bucket_of(value)].fetch_add(1, memory_order_relaxed);
+  total.fetch_add(1, memory_order_relaxed);
+  uint64_t seen = largest.load(memory_order_relaxed);
+  while(value > seen && !largest.compare_exchange_weak(seen, value, memory_order_relaxed))
+    ;
+}
+
+// Number of values recorded
+uint64_t Histogram::count() const {
+  return total.load(memory_order_relaxed);
+}
+
+// Largest value recorded
+uint64_t Histogram::max() const {
+  return largest.load(memory_order_relaxed);
+}
+
+// Value below which p percent of the recorded values fall, rounded
+// up to the end of its bucket. Returns 0 if nothing was recorded.
+uint64_t Histogram::percentile(double p) const {
+  uint64_t n = count();
+  if(n == 0)
+    return 0;
+  uint64_t rank = (uint64_t) (p / 100.0 * n + 0.5);
+  if(rank == 0)
+    rank = 1;
+  uint64_t seen = 0;
+  for(int i = 0; i < NUM_BUCKETS; i++) {
+    seen += buckets[i].load(memory_order_relaxed);
+    if(seen >= rank) {
+      uint64_t end = bucket_end(i);
+      return end < max() ? end : max();
+    }
+  }
+  return max();
+}
+
+// bucket index of value
+int Histogram::bucket_of(uint64_t value) {
+  if(value < (uint64_t) SUB_COUNT)
+    return value;
+  int msb = 63 - __builtin_clzll(value);
+  int sub = (value >> (msb - SUB_BITS)) & (SUB_COUNT - 1);
+  return (msb - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+// largest value that falls into bucket i
+uint64_t Histogram::bucket_end(int i) {
+  if(i < SUB_COUNT)
+    return i;
+  int msb = i / SUB_COUNT + SUB_BITS - 1;
+  uint64_t sub = i % SUB_COUNT;
+  uint64_t start = (SUB_COUNT + sub) << (msb - SUB_BITS);
+  return start + (((uint64_t) 1 << (msb - SUB_BITS)) - 1);
+}
+
+OpStats::OpStats() : count(0), errors(0), block_reads(0), disk_reads(0),
+  block_writes(0), bytes_in(0), bytes_out(0), leases(0) {
+}
+
+ServerStats::ServerStats() : start(chrono::steady_clock::now()) {
+}
+
+// Records a request of operation op that took latency to serve,
+// using the counters its thread collected
+void ServerStats::record(Opcode op, const RequestCounters& counters, uint64_t bytes_in,
+                         chrono::microseconds latency) {
+  OpStats& s = ops[op];
+  s.count.fetch_add(1, memory_order_relaxed);
+  if(counters.code != 200)
+    s.errors.fetch_add(1, memory_order_relaxed);
+  s.block_reads.fetch_add(counters.block_reads, memory_order_relaxed);
+  s.disk_reads.fetch_add(counters.disk_reads, memory_order_relaxed);
+  s.block_writes.fetch_add(counters.block_writes, memory_order_relaxed);
+  s.bytes_in.fetch_add(bytes_in, memory_order_relaxed);
+  s.bytes_out.fetch_add(counters.bytes_out, memory_order_relaxed);
+  s.leases.fetch_add(counters.leases, memory_order_relaxed);
+  s.latency.record(latency.count());
+}
+
+// Returns a table of the counters and latency percentiles per operation
+string ServerStats::report() const {
+  double uptime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  ostringstream out;
+  out << "uptime " << fixed << setprecision(1) << uptime << " s\n";
+  out << left << setw(8) << "op" << right << setw(9) << "count" << setw(7) << "errors"
+      << setw(9) << "p50 us" << setw(9) << "p99 us" << setw(9) << "p999 us" << setw(9) << "max us"
+      << setw(8) << "rd/op" << setw(8) << "disk/op" << setw(8) << "wr/op" << setw(11) << "bytes in"
+      << setw(11) << "bytes out" << setw(8) << "leases";
+  for(int op = 0; op < NUM_OPCODES; op++) {
+    const OpStats& s = ops[op];
+    uint64_t n = s.count.load(memory_order_relaxed);
+    if(n == 0)
+      continue;
+    out << "\n" << left << setw(8) << OPCODE_NAMES[op] << right << setw(9) << n
+        << setw(7) << s.errors.load(memory_order_relaxed)
+        << setw(9) << s.latency.percentile(50) << setw(9) << s.latency.percentile(99)
+        << setw(9) << s.latency.percentile(99.9) << setw(9) << s.latency.max()
+        << setprecision(1)
+        << setw(8) << (double) s.block_reads.load(memory_order_relaxed) / n
+        << setw(8) << (double) s.disk_reads.load(memory_order_relaxed) / n
+        << setw(8) << (double) s.block_writes.load(memory_order_relaxed) / n
+        << setw(11) << s.bytes_in.load(memory_order_relaxed)
+        << setw(11) << s.bytes_out.load(memory_order_relaxed)
+        << setw(8) << s.leases.load(memory_order_relaxed);
+  }
+  return out.str();
+}
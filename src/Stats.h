@@ -0,0 +1,114 @@
+// CPSC 3500: Server statistics
+// Per-operation counters and latency histograms. Recording is lock-free:
+// every counter is a relaxed atomic, and the work done for the request a
+// thread is serving is tallied in thread-local counters first.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+// Operations counted separately, OP_OTHER covers unknown commands
+enum Opcode {
+  OP_MKDIR, OP_CD, OP_HOME, OP_RMDIR, OP_LS, OP_CREATE, OP_APPEND,
+  OP_CAT, OP_HEAD, OP_RM, OP_STAT, OP_OPEN, OP_CLOSE, OP_READ, OP_WRITE,
+  OP_CP, OP_MV, OP_DU, OP_SNAPSHOT, OP_LEASE, OP_STATS, OP_TRACE, OP_OTHER,
+  NUM_OPCODES
+};
+
+// Returns the opcode for the command name at the start of the command line
+Opcode opcode_of(const char *command);
+
+// Returns the command name of op
+const char* opcode_name(Opcode op);
+
+// Latency histogram in the style of HdrHistogram: buckets are exact up
+// to 2^SUB_BITS, above that each power of two is split into 2^SUB_BITS
+// buckets, so any recorded value is off by at most 1/16
+class Histogram {
+
+  public:
+    Histogram();
+
+    // Adds one value
+    void record(uint64_t value);
+
+    // Number of values recorded
+    uint64_t count() const;
+
+    // Largest value recorded
+    uint64_t max() const;
+
+    // Value below which p percent of the recorded values fall, rounded
+    // up to the end of its bucket. Returns 0 if nothing was recorded.
+    uint64_t percentile(double p) const;
+
+  private:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+
+    // bucket index of value
+    static int bucket_of(uint64_t value);
+
+    // largest value that falls into bucket i
+    static uint64_t bucket_end(int i);
+};
+
+// Work done while serving one request, counted by the thread serving it
+struct RequestCounters {
+  uint64_t block_reads = 0;	// BasicFileSys block reads
+  uint64_t disk_reads = 0;	// block reads neither journal nor cache could serve
+  uint64_t block_writes = 0;	// BasicFileSys block writes
+  uint64_t bytes_out = 0;	// response bytes written to the socket
+  uint64_t leases = 0;		// read leases granted
+  int code = 0;			// response code sent, 0 if none
+};
+
+// counters of the request the current thread is serving
+extern thread_local RequestCounters request_counters;
+
+// Totals for one operation
+struct OpStats {
+  std::atomic<uint64_t> count;		// requests served
+  std::atomic<uint64_t> errors;		// requests answered with an error code
+  std::atomic<uint64_t> block_reads;	// block reads across all requests
+  std::atomic<uint64_t> disk_reads;	// block reads that went to the disk
+  std::atomic<uint64_t> block_writes;	// block writes across all requests
+  std::atomic<uint64_t> bytes_in;	// request bytes received
+  std::atomic<uint64_t> bytes_out;	// response bytes sent
+  std::atomic<uint64_t> leases;		// read leases granted
+  Histogram latency;			// request latency in microseconds
+
+  OpStats();
+};
+
+class ServerStats {
+
+  public:
+    ServerStats();
+
+    // Records a request of operation op that took latency to serve,
+    // using the counters its thread collected
+    void record(Opcode op, const RequestCounters& counters, uint64_t bytes_in,
+                std::chrono::microseconds latency);
+
+    // Returns a table of the counters and latency percentiles per operation
+    std::string report() const;
+
+  private:
+    OpStats ops[NUM_OPCODES];
+    std::chrono::steady_clock::time_point start; // time the server started
+};
+
+// statistics of the server process
+extern ServerStats server_stats;
+
+#endif
@@ -0,0 +1,128 @@
+// CPSC 3500: Tracing
+// Low-overhead tracepoints on the server's hot path. Each thread records
+// events into its own fixed-size ring buffer without locking, the oldest
+// events are overwritten. Tracing is off until enabled at runtime and the
+// buffers export as Chrome trace JSON (chrome://tracing or Perfetto).
+
+#include <vector>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
+using namespace std;
+
+#include "Trace.h"
+
+// events kept per thread
+static const int TRACE_EVENTS = 4096;
+
+atomic<bool> trace_on(false);
+
+// One recorded event, times in ns since trace_epoch
+struct TraceEvent {
+  const char *name;
+  int64_t ts;
+  int64_t dur;
+  int arg;
+};
+
+// Ring buffer of one thread. Only the owning thread writes events, head
+// counts all events ever written and is published after each one.
+struct TraceBuffer {
+  TraceEvent events[TRACE_EVENTS];
+  atomic<uint64_t> head;
+  int tid;		// thread id shown in the trace
+  bool in_use;		// owned by a live thread
+};
+
+// start of the trace timeline
+static const trace_clock::time_point trace_epoch = trace_clock::now();
+
+// All ring buffers. Buffers of exited threads are handed to new threads
+// instead of being freed, so the registry lock is only taken when a
+// thread records its first event, exits, or the trace is exported.
+static mutex registry_lock;
+static vector<TraceBuffer*> registry;
+
+// Claims a ring buffer for the calling thread and gives it back on exit
+struct TraceOwner {
+  TraceBuffer *buf;
+
+  TraceOwner() : buf(NULL) {
+    lock_guard<mutex> guard(registry_lock);
+    for(size_t i = 0; i < registry.size() && !buf; i++) {
+      if(!registry[i]->in_use)
+        buf = registry[i];
+    }
+    if(!buf) {
+      buf = new TraceBuffer;
+      buf->head = 0;
+      buf->tid = registry.size() + 1;
+      registry.push_back(buf);
+    }
+    buf->in_use = true;
+  }
+
+  ~TraceOwner() {
+    lock_guard<mutex> guard(registry_lock);
+    buf->in_use = false;
+  }
+};
+
+static thread_local TraceOwner owner;
+
+// Turns tracing on or off
+void trace_enable(bool on) {
+  trace_on.store(on, memory_order_relaxed);
+}
+
+// Records an event called name that started at start and ends now on the
+// calling thread's ring buffer. arg is shown with the event if not -1.
+void trace_event(const char *name, trace_clock::time_point start, int arg) {
+  trace_clock::time_point end = trace_clock::now();
+  TraceBuffer *buf = owner.buf;
+  uint64_t head = buf->head.load(memory_order_relaxed);
+  TraceEvent& ev = buf->events[head % TRACE_EVENTS];
+  ev.name = name;
+  ev.ts = chrono::duration_cast<chrono::nanoseconds>(start - trace_epoch).count();
+  ev.dur = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+  ev.arg = arg;
+  buf->head.store(head + 1, memory_order_release);
+}
+
+// Returns the events in all ring buffers as Chrome trace JSON
+string trace_export() {
+  ostringstream out;
+  out << fixed << setprecision(3);
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+
+  lock_guard<mutex> guard(registry_lock);
+  for(size_t b = 0; b < registry.size(); b++) {
+    TraceBuffer *buf = registry[b];
+
+    //Copy the ring, then drop events the owner overwrote meanwhile
+    uint64_t head = buf->head.load(memory_order_acquire);
+    uint64_t begin = head > (uint64_t) TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+    vector<TraceEvent> events;
+    for(uint64_t i = begin; i < head; i++)
+      events.push_back(buf->events[i % TRACE_EVENTS]);
+    uint64_t after = buf->head.load(memory_order_acquire);
+    uint64_t valid = after > (uint64_t) TRACE_EVENTS ? after - TRACE_EVENTS : 0;
+
+    for(uint64_t i = begin; i < head; i++) {
+      if(i < valid)
+        continue;
+      const TraceEvent& ev = events[i - begin];
+      out << (first ? "" : ",") << "\n{\"name\":\"" << ev.name << "\",\"ph\":\"X\",\"pid\":1"
+          << ",\"tid\":" << buf->tid << ",\"ts\":" << ev.ts / 1000.0
+          << ",\"dur\":" << ev.dur / 1000.0;
+      if(ev.arg != -1)
+        out << ",\"args\":{\"arg\":" << ev.arg << "}";
+      out << "}";
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+  return out.str();
+}
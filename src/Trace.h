@@ -0,0 +1,52 @@
+// CPSC 3500: Tracing
+// Low-overhead tracepoints on the server's hot path. Each thread records
+// events into its own fixed-size ring buffer without locking, the oldest
+// events are overwritten. Tracing is off until enabled at runtime and the
+// buffers export as Chrome trace JSON (chrome://tracing or Perfetto).
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+typedef std::chrono::steady_clock trace_clock;
+
+// true while tracepoints record events
+extern std::atomic<bool> trace_on;
+
+// Turns tracing on or off
+void trace_enable(bool on);
+
+// Records an event called name that started at start and ends now on the
+// calling thread's ring buffer. arg is shown with the event if not -1.
+// name must be a string literal or otherwise outlive the trace.
+void trace_event(const char *name, trace_clock::time_point start, int arg = -1);
+
+// Returns the events in all ring buffers as Chrome trace JSON
+std::string trace_export();
+
+// Traces the enclosing scope as one event if tracing is on when it starts
+class TraceScope {
+
+  public:
+    TraceScope(const char *name, int arg = -1)
+      : name(name), arg(arg), on(trace_on.load(std::memory_order_relaxed)) {
+      if(on)
+        start = trace_clock::now();
+    }
+
+    ~TraceScope() {
+      if(on)
+        trace_event(name, start, arg);
+    }
+
+  private:
+    const char *name;
+    int arg;
+    bool on;
+    trace_clock::time_point start;
+};
+
+#endif
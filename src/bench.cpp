@@ -0,0 +1,406 @@
+// CPSC 3500: nfsbench
+// Load generator and latency benchmark for the network file system. Starts
+// a local server on a temporary DISK (or uses a running one), drives a mix
+// of operations from concurrent clients and reports throughput and latency
+// percentiles per operation.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+using namespace std;
+
+#include "NfsClient.h"
+#include "Blocks.h"
+
+// Operations in the generated mix, in the order they are reported
+static const char* OPS[] = {"mkdir", "create", "append", "cat", "ls", "rm"};
+static const int NUM_OPS = 6;
+
+// Each client works in its own directory /gX/cY, at most CLIENTS_PER_GROUP
+// clients share a group so no directory overflows MAX_DIR_ENTRIES
+static const int CLIENTS_PER_GROUP = 8;
+
+// Files and directories a client keeps in its directory at most
+static const int MAX_FILES = 6;
+static const int MAX_DIRS = 2;
+
+// Benchmark settings from the command line
+struct Options {
+  string server_bin = "./nfsserver";	// server to start
+  string address;			// host:port of a running server, "" to start one
+  int port = 0;				// port for the started server, 0 to pick one
+  string durability;			// -d mode for the started server, "" for its default
+  bool compress = false;		// started server compresses new files
+  bool dedup = false;			// started server shares identical data blocks
+  int clients = 4;			// concurrent clients
+  int seconds = 5;			// run time of the generated mix
+  int ops = 0;				// ops per client instead of a run time, 0 if unset
+  int append_size = 64;			// bytes per append
+  int weights[NUM_OPS] = {1, 2, 4, 4, 1, 1}; // mix weights, same order as OPS
+  string script;			// script to replay instead of the mix
+  bool cache = false;			// clients cache under read leases
+  bool write_behind = false;		// clients buffer appends
+};
+
+// Latencies in microseconds, error counts and client cache hits, per operation
+struct Samples {
+  map<string, vector<long> > latency;
+  map<string, long> errors;
+  map<string, long> cached;
+
+  // Records one request
+  void add(const string& op, const NfsResult& result) {
+    latency[op].push_back(result.latency.count());
+    if(!result.ok())
+      errors[op]++;
+    if(result.cached)
+      cached[op]++;
+  }
+
+  // Adds all samples of other
+  void merge(const Samples& other) {
+    for(auto it = other.latency.begin(); it != other.latency.end(); it++)
+      latency[it->first].insert(latency[it->first].end(), it->second.begin(), it->second.end());
+    for(auto it = other.errors.begin(); it != other.errors.end(); it++)
+      errors[it->first] += it->second;
+    for(auto it = other.cached.begin(); it != other.cached.end(); it++)
+      cached[it->first] += it->second;
+  }
+};
+
+static void usage() {
+  cerr << "Usage: ./nfsbench [options]" << endl;
+  cerr << "  -a host:port  use a running server instead of starting one" << endl;
+  cerr << "  -S path       server binary to start (default ./nfsserver)" << endl;
+  cerr << "  -P port       port for the started server (default: pick one)" << endl;
+  cerr << "  -D mode       durability of the started server: none, periodic or request" << endl;
+  cerr << "  -Z            started server compresses new files" << endl;
+  cerr << "  -U            started server shares identical data blocks" << endl;
+  cerr << "  -c n          concurrent clients (default 4)" << endl;
+  cerr << "  -d seconds    run time (default 5)" << endl;
+  cerr << "  -n ops        ops per client instead of a run time" << endl;
+  cerr << "  -b bytes      bytes per append (default 64)" << endl;
+  cerr << "  -m mix        op weights, e.g. mkdir=1,create=2,append=4,cat=4,ls=1,rm=1" << endl;
+  cerr << "  -r script     replay a script (e.g. testscript.txt) on every client in its own dir" << endl;
+  cerr << "  -C            clients cache under read leases" << endl;
+  cerr << "  -W            clients buffer appends (write-behind)" << endl;
+  exit(1);
+}
+
+// Parses a mix like "append=4,cat=4" into weights. Returns false if invalid.
+static bool parse_mix(const string& mix, int weights[]) {
+  for(int i = 0; i < NUM_OPS; i++)
+    weights[i] = 0;
+  istringstream ss(mix);
+  string item;
+  while(getline(ss, item, ',')) {
+    size_t eq = item.find('=');
+    if(eq == string::npos)
+      return false;
+    string name = item.substr(0, eq);
+    int i = 0;
+    while(i < NUM_OPS && name != OPS[i])
+      i++;
+    if(i == NUM_OPS)
+      return false;
+    weights[i] = atoi(item.c_str() + eq + 1);
+  }
+  return true;
+}
+
+// Starts the server in a fresh temporary directory so it formats a new
+// DISK there. Returns the server pid, dir is set to the directory.
+static pid_t start_server(const Options& opts, string& dir) {
+  char bin[PATH_MAX];
+  if(!realpath(opts.server_bin.c_str(), bin)) {
+    perror(opts.server_bin.c_str());
+    exit(1);
+  }
+  char tmpl[] = "/tmp/nfsbench.XXXXXX";
+  if(!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  dir = tmpl;
+
+  pid_t pid = fork();
+  if(pid == -1) {
+    perror("fork");
+    exit(1);
+  }
+  if(pid == 0) {
+    if(chdir(dir.c_str()) == -1) {
+      perror("chdir");
+      _exit(1);
+    }
+    string port = to_string(opts.port);
+    vector<const char*> args(1, bin);
+    if(!opts.durability.empty()) {
+      args.push_back("-d");
+      args.push_back(opts.durability.c_str());
+    }
+    if(opts.compress)
+      args.push_back("-z");
+    if(opts.dedup)
+      args.push_back("-u");
+    args.push_back(port.c_str());
+    args.push_back(NULL);
+    execv(bin, (char* const*) &args[0]);
+    perror("execv");
+    _exit(1);
+  }
+  return pid;
+}
+
+// Stops the started server and removes its temporary directory
+static void stop_server(pid_t pid, const string& dir) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  unlink((dir + "/DISK").c_str());
+  rmdir(dir.c_str());
+}
+
+// Connects client to address, retrying while a started server comes up
+static bool connect_retry(NfsClient& client, const string& address) {
+  for(int attempt = 0; attempt < 50; attempt++) {
+    if(client.mount(address).ok())
+      return true;
+    this_thread::sleep_for(chrono::milliseconds(100));
+  }
+  return false;
+}
+
+// Moves client number id into its own directory /gX/cY, making it first
+// if make is set
+static void enter_own_dir(NfsClient& client, int id, bool make) {
+  string group = "g" + to_string(id / CLIENTS_PER_GROUP);
+  string own = "c" + to_string(id % CLIENTS_PER_GROUP);
+  if(make)
+    client.mkdir(group);
+  client.cd(group);
+  if(make)
+    client.mkdir(own);
+  client.cd(own);
+}
+
+// Runs the generated mix from client number id until done says stop or
+// the op budget is used up
+static void run_mix(int id, const Options& opts, const string& address,
+                    atomic<bool>& stop, Samples& samples) {
+  NfsClient client;
+  if(opts.cache)
+    client.enable_cache();
+  if(opts.write_behind)
+    client.enable_write_behind();
+  if(!connect_retry(client, address)) {
+    cerr << "client " << id << ": could not connect to " << address << endl;
+    return;
+  }
+
+  enter_own_dir(client, id, true);
+
+  mt19937 rng(id + 1);
+  int total_weight = 0;
+  for(int i = 0; i < NUM_OPS; i++)
+    total_weight += opts.weights[i];
+  vector<string> files, dirs;
+  map<string, unsigned int> sizes;
+  string data(opts.append_size, 'a' + id % 26);
+  int next_name = 0;
+
+  for(int n = 0; !stop && (opts.ops == 0 || n < opts.ops); n++) {
+    //Pick an op by weight
+    int pick = rng() % total_weight;
+    int op = 0;
+    while(pick >= opts.weights[op])
+      pick -= opts.weights[op++];
+    string name = OPS[op];
+
+    //Keep the directory within bounds: ops that cannot run on the current
+    //state turn into the op that makes room for them
+    if(name == "mkdir" && (int) dirs.size() >= MAX_DIRS) {
+      samples.add("rmdir", client.rmdir(dirs.front()));
+      dirs.erase(dirs.begin());
+    } else if(name == "mkdir") {
+      string dname = "d" + to_string(next_name++);
+      samples.add(name, client.mkdir(dname));
+      dirs.push_back(dname);
+    } else if((name == "create" && (int) files.size() >= MAX_FILES) ||
+              (name == "rm" && !files.empty())) {
+      samples.add("rm", client.rm(files.front()));
+      sizes.erase(files.front());
+      files.erase(files.begin());
+    } else if(name == "create" || files.empty()) {
+      string fname = "f" + to_string(next_name++);
+      samples.add("create", client.create(fname));
+      files.push_back(fname);
+      sizes[fname] = 0;
+    } else if(name == "append") {
+      string fname = files[rng() % files.size()];
+      if(sizes[fname] + data.length() > (unsigned int) MAX_FILE_SIZE) {
+        samples.add("rm", client.rm(fname));
+        samples.add("create", client.create(fname));
+        sizes[fname] = 0;
+      }
+      samples.add(name, client.append(fname, data));
+      sizes[fname] += data.length();
+    } else if(name == "cat") {
+      samples.add(name, client.cat(files[rng() % files.size()]));
+    } else if(name == "ls") {
+      samples.add(name, client.ls());
+    }
+  }
+  client.unmount();
+}
+
+// Replays the script lines from client number id in its own directory,
+// which stands in for the root so replays do not touch each other's names
+static void run_script(int id, const vector<string>& lines, const string& address,
+                       const Options& opts, Samples& samples) {
+  NfsClient client;
+  if(opts.cache)
+    client.enable_cache();
+  if(!connect_retry(client, address)) {
+    cerr << "client " << id << ": could not connect to " << address << endl;
+    return;
+  }
+  enter_own_dir(client, id, true);
+  for(size_t i = 0; i < lines.size(); i++) {
+    istringstream ss(lines[i]);
+    string name;
+    if(!(ss >> name) || name == "quit")
+      continue;
+    samples.add(name, client.command(lines[i]));
+    if(name == "home")
+      enter_own_dir(client, id, false);
+  }
+  client.unmount();
+}
+
+// Returns the p-th percentile of the sorted latencies
+static long percentile(const vector<long>& sorted, double p) {
+  size_t i = (size_t) (p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+// Prints throughput and latency percentiles per op
+static void report(Samples& samples, double seconds, int clients) {
+  long total = 0;
+  cout << left << setw(8) << "op" << right << setw(10) << "count"
+       << setw(8) << "errors" << setw(8) << "cached" << setw(12) << "ops/s"
+       << setw(10) << "p50 us" << setw(10) << "p99 us" << setw(10) << "p999 us" << endl;
+  for(auto it = samples.latency.begin(); it != samples.latency.end(); it++) {
+    vector<long>& lat = it->second;
+    sort(lat.begin(), lat.end());
+    total += lat.size();
+    cout << left << setw(8) << it->first << right << setw(10) << lat.size()
+         << setw(8) << samples.errors[it->first] << setw(8) << samples.cached[it->first]
+         << setw(12) << fixed << setprecision(0) << lat.size() / seconds
+         << setw(10) << percentile(lat, 50) << setw(10) << percentile(lat, 99)
+         << setw(10) << percentile(lat, 99.9) << endl;
+  }
+  cout << "total: " << total << " ops in " << setprecision(2) << seconds << " s from "
+       << clients << " clients, " << setprecision(0) << total / seconds << " ops/s" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  Options opts;
+  int c;
+  while((c = getopt(argc, argv, "a:S:P:D:ZUc:d:n:b:m:r:CW")) != -1) {
+    switch(c) {
+      case 'a': opts.address = optarg; break;
+      case 'S': opts.server_bin = optarg; break;
+      case 'P': opts.port = atoi(optarg); break;
+      case 'D': opts.durability = optarg; break;
+      case 'Z': opts.compress = true; break;
+      case 'U': opts.dedup = true; break;
+      case 'c': opts.clients = atoi(optarg); break;
+      case 'd': opts.seconds = atoi(optarg); break;
+      case 'n': opts.ops = atoi(optarg); break;
+      case 'b': opts.append_size = atoi(optarg); break;
+      case 'm': if(!parse_mix(optarg, opts.weights)) usage(); break;
+      case 'r': opts.script = optarg; break;
+      case 'C': opts.cache = true; break;
+      case 'W': opts.write_behind = true; break;
+      default: usage();
+    }
+  }
+  int total_weight = 0;
+  for(int i = 0; i < NUM_OPS; i++)
+    total_weight += opts.weights[i];
+  if(optind != argc || opts.clients < 1 || opts.append_size < 1 ||
+     opts.append_size > 2048 || total_weight <= 0 ||
+     opts.clients > CLIENTS_PER_GROUP * MAX_DIR_ENTRIES)
+    usage();
+
+  //Read the script to replay
+  vector<string> lines;
+  if(!opts.script.empty()) {
+    ifstream infile(opts.script.c_str());
+    if(infile.fail()) {
+      cerr << "Could not open script file" << endl;
+      return 1;
+    }
+    string line;
+    while(getline(infile, line))
+      lines.push_back(line);
+  }
+
+  //Start a local server on a temporary DISK unless one was given
+  pid_t server = 0;
+  string dir;
+  string address = opts.address;
+  if(address.empty()) {
+    if(opts.port == 0)
+      opts.port = 20000 + getpid() % 20000;
+    server = start_server(opts, dir);
+    address = "localhost:" + to_string(opts.port);
+  }
+
+  //Run the clients
+  vector<Samples> samples(opts.clients);
+  vector<thread> clients;
+  atomic<bool> stop(false);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for(int i = 0; i < opts.clients; i++) {
+    if(!lines.empty())
+      clients.push_back(thread(run_script, i, cref(lines), address, cref(opts), ref(samples[i])));
+    else
+      clients.push_back(thread(run_mix, i, cref(opts), address, ref(stop), ref(samples[i])));
+  }
+  if(lines.empty() && opts.ops == 0) {
+    this_thread::sleep_for(chrono::seconds(opts.seconds));
+    stop = true;
+  }
+  for(size_t i = 0; i < clients.size(); i++)
+    clients[i].join();
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  if(server)
+    stop_server(server, dir);
+
+  Samples all;
+  for(size_t i = 0; i < samples.size(); i++)
+    all.merge(samples[i]);
+  if(all.latency.empty()) {
+    cerr << "No requests completed" << endl;
+    return 1;
+  }
+  report(all, seconds, opts.clients);
+  return 0;
+}
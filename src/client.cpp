@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 using namespace std;
 
 #include "Shell.h"
@@ -10,20 +11,48 @@ using namespace std;
 int main(int argc, char **argv)
 {
   Shell shell;
+  char *script = NULL;
 
-  if (argc == 2) {
-    shell.mountNFS(string(argv[1]));
-    shell.run();
+  // parse the optional flags before server:port
+  int i = 1;
+  bool valid = true;
+  while (valid && i < argc - 1) {
+    if (strcmp(argv[i], "-c") == 0) {
+      shell.enable_cache();
+      i++;
+    }
+    else if (strcmp(argv[i], "-w") == 0) {
+      shell.enable_write_behind();
+      i++;
+    }
+    else if (strcmp(argv[i], "-p") == 0 && i + 2 < argc && atoi(argv[i + 1]) > 0) {
+      shell.set_pool_size(atoi(argv[i + 1]));
+      i += 2;
+    }
+    else if (strcmp(argv[i], "-s") == 0 && i + 2 < argc) {
+      script = argv[i + 1];
+      i += 2;
+    }
+    else {
+      valid = false;
+    }
   }
-  else if (argc == 4 && strcmp(argv[1], "-s") == 0) {
-    shell.mountNFS(string(argv[3]));
-    shell.run_script(argv[2]);
+
+  if (valid && i == argc - 1) {
+    shell.mountNFS(string(argv[i]));
+    if (script)
+      shell.run_script(script);
+    else
+      shell.run();
   }
   else {
     cerr << "Invalid command line" << endl;
     cerr << "Usage (one of the following): " << endl;
-    cerr << "./nfsclient server:port" << endl;
-    cerr << "./nfsclient -s <script-name> server:port" << endl;
+    cerr << "./nfsclient [-c] [-w] [-p n] server:port" << endl;
+    cerr << "./nfsclient [-c] [-w] [-p n] -s <script-name> server:port" << endl;
+    cerr << "  -c  cache cat/head/stat results under server read leases" << endl;
+    cerr << "  -w  coalesce consecutive appends to a file (write-behind)" << endl;
+    cerr << "  -p  open n connections, cat of several files runs in parallel" << endl;
   }
 
   return 0;
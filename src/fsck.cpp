@@ -0,0 +1,328 @@
+// CPSC 3500: nfsfsck
+// Consistency checker for a DISK image. Replays the journal, reads the file
+// system blocks sequentially in large chunks, walks the directory tree from
+// block 1 with subtrees verified in parallel, and rebuilds the free bitmap
+// from the reachable blocks to find orphaned and double-allocated blocks.
+// Data blocks may be shared by the files of a copy, directory and inode
+// blocks may not. Every reachable block is also checked against its stored
+// checksum.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+using namespace std;
+
+#include "BasicFileSys.h"
+#include "Disk.h"
+#include "Checksum.h"
+#include "Blocks.h"
+
+// blocks read per system call when loading the image
+static const int CHUNK_BLOCKS = 64;
+
+// A directory whose subtree is still to be verified
+struct Subtree {
+  short block_num;
+  string path;
+};
+
+// Checks the image and collects the problems found
+class Checker {
+
+  public:
+    explicit Checker(const vector<datablock_t>& image) : image(image) {
+      for(int i = 0; i < NUM_BLOCKS; i++) {
+        refs[i] = 0;
+        data_refs[i] = 0;
+      }
+    }
+
+    // Walks the tree from the root with num_threads workers
+    void walk(int num_threads) {
+      refs[0] = 1;
+      claim(1, "/");
+      vector<Subtree> top = check_dir(1, "/");
+
+      //Each top-level directory is one unit of work
+      vector<thread> workers;
+      atomic<size_t> next(0);
+      for(int t = 0; t < num_threads; t++) {
+        workers.push_back(thread([&]() {
+          size_t i;
+          while((i = next++) < top.size())
+            walk_subtree(top[i]);
+        }));
+      }
+      for(size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+      //Files may share data blocks, nothing else may
+      vector<int> mixed;
+      for(int b = 0; b < NUM_BLOCKS; b++) {
+        if(refs[b] > 0 && data_refs[b] > 0)
+          mixed.push_back(b);
+      }
+      if(!mixed.empty())
+        error("blocks used both as data and as a directory or inode: " + ranges(mixed));
+    }
+
+    // Compares the on-disk bitmap with the reachable blocks, reports
+    // orphans and blocks in use but marked free. Fills rebuilt with the
+    // bitmap of the reachable blocks.
+    void check_bitmap(superblock_t& rebuilt) {
+      const superblock_t& super = *(const superblock_t*) &image[0];
+      memset(rebuilt.bitmap, 0, BLOCK_SIZE);
+      vector<int> orphans, unmarked;
+      for(int b = 0; b < NUM_BLOCKS; b++) {
+        bool used = super.bitmap[b / 8] & (1 << (b % 8));
+        bool reachable = refs[b] > 0 || data_refs[b] > 0;
+        if(reachable)
+          rebuilt.bitmap[b / 8] |= 1 << (b % 8);
+        if(used && !reachable)
+          orphans.push_back(b);
+        if(!used && reachable)
+          unmarked.push_back(b);
+      }
+      if(!orphans.empty())
+        error("orphaned blocks, allocated but unreachable: " + ranges(orphans));
+      if(!unmarked.empty())
+        error("blocks in use but marked free: " + ranges(unmarked));
+    }
+
+    // Reports reachable blocks that do not match their stored checksum
+    void check_checksums(const ChecksumTable& checksums) {
+      vector<int> corrupt;
+      for(int b = 0; b < NUM_BLOCKS; b++) {
+        if((refs[b] > 0 || data_refs[b] > 0) && !checksums.verify(b, &image[b]))
+          corrupt.push_back(b);
+      }
+      if(!corrupt.empty())
+        error("blocks not matching their checksum: " + ranges(corrupt));
+    }
+
+    // Prints the summary and every problem, returns the number of problems
+    int report() {
+      int used = 0, shared = 0;
+      for(int b = 0; b < NUM_BLOCKS; b++) {
+        used += refs[b] > 0 || data_refs[b] > 0;
+        shared += data_refs[b] > 1;
+      }
+      cout << dirs << " directories, " << files << " files, " << data_blocks
+           << " data blocks";
+      if(shared)
+        cout << " (" << shared << " shared)";
+      cout << ", " << used << "/" << NUM_BLOCKS << " blocks in use" << endl;
+      for(size_t i = 0; i < problems.size(); i++)
+        cout << problems[i] << endl;
+      return problems.size();
+    }
+
+  private:
+    const vector<datablock_t>& image;
+    atomic<unsigned short> refs[NUM_BLOCKS]; // times each block is referenced as a directory or inode
+    atomic<unsigned short> data_refs[NUM_BLOCKS]; // times each block is referenced as data
+    atomic<int> dirs{0}, files{0}, data_blocks{0};
+    mutex problems_lock;
+    vector<string> problems;
+
+    // Records a problem
+    void error(const string& msg) {
+      lock_guard<mutex> guard(problems_lock);
+      problems.push_back(msg);
+    }
+
+    // Marks block_num as referenced from path. Returns false if it already
+    // was, so it is not verified twice.
+    bool claim(short block_num, const string& path) {
+      if(refs[block_num]++ == 0)
+        return true;
+      error(path + ": block " + to_string(block_num) + " is double-allocated");
+      return false;
+    }
+
+    // Verifies a subtree depth first on the calling thread
+    void walk_subtree(const Subtree& root) {
+      vector<Subtree> stack(1, root);
+      while(!stack.empty()) {
+        Subtree dir = stack.back();
+        stack.pop_back();
+        vector<Subtree> children = check_dir(dir.block_num, dir.path);
+        stack.insert(stack.end(), children.begin(), children.end());
+      }
+    }
+
+    // Verifies a directory block and the files in it. Returns the
+    // subdirectories still to be verified.
+    vector<Subtree> check_dir(short block_num, const string& path) {
+      vector<Subtree> subdirs;
+      const dirblock_t& dir = *(const dirblock_t*) &image[block_num];
+      if(dir.magic != DIR_MAGIC_NUM) {
+        error(path + ": directory block " + to_string(block_num) + " has a bad magic number");
+        return subdirs;
+      }
+      dirs++;
+
+      unsigned int in_use = 0;
+      for(int i = 0; i < MAX_DIR_ENTRIES; i++) {
+        short child = dir.dir_entries[i].block_num;
+        if(child == 0)
+          continue;
+        in_use++;
+        const char* name = dir.dir_entries[i].name;
+        size_t len = strnlen(name, MAX_FNAME_SIZE + 1);
+        string child_path = path + string(name, len);
+        if(len == 0 || len > MAX_FNAME_SIZE)
+          error(path + ": entry " + to_string(i) + " has a bad name");
+        for(int j = 0; j < i; j++) {
+          if(dir.dir_entries[j].block_num != 0 && !strncmp(dir.dir_entries[j].name, name, MAX_FNAME_SIZE + 1))
+            error(child_path + ": duplicate entry");
+        }
+        if(child < 2 || child >= NUM_BLOCKS) {
+          error(child_path + ": block number " + to_string(child) + " out of range");
+          continue;
+        }
+        if(!claim(child, child_path))
+          continue;
+
+        unsigned int magic = *(const unsigned int*) &image[child];
+        if(magic == DIR_MAGIC_NUM) {
+          Subtree sub = {child, child_path + "/"};
+          subdirs.push_back(sub);
+        } else if(magic == INODE_MAGIC_NUM) {
+          check_inode(child, child_path);
+        } else {
+          error(child_path + ": block " + to_string(child) + " is neither a directory nor an inode");
+        }
+      }
+      if(in_use != dir.num_entries)
+        error(path + ": entry count is " + to_string(dir.num_entries) + ", found " + to_string(in_use));
+      return subdirs;
+    }
+
+    // Verifies an inode and counts the references to its data blocks
+    void check_inode(short block_num, const string& path) {
+      const inode_t& inode = *(const inode_t*) &image[block_num];
+      files++;
+      if(inode.size > (unsigned int) MAX_FILE_SIZE) {
+        error(path + ": size " + to_string(inode.size) + " exceeds the maximum file size");
+        return;
+      }
+      if(inode.flags & INODE_INLINE) {
+        if(inode.size > (unsigned int) INLINE_SIZE)
+          error(path + ": size " + to_string(inode.size) + " is too large for inline data");
+        return;
+      }
+      unsigned int num_blks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      for(unsigned int i = 0; i < num_blks; i++) {
+        short blk = inode.blocks[i];
+        //a full group compressed into fewer blocks leaves its last slots 0
+        bool in_full_group = (inode.flags & INODE_COMPRESSED) && i % GROUP_BLOCKS != 0 &&
+                             (i / GROUP_BLOCKS + 1) * GROUP_SIZE <= inode.size;
+        if(in_full_group && blk == 0)
+          continue;
+        if(in_full_group && inode.blocks[i - 1] == 0) {
+          error(path + ": data block " + to_string(i) + " follows an unused slot of its group");
+          continue;
+        }
+        if(blk < 2 || blk >= NUM_BLOCKS) {
+          error(path + ": data block " + to_string(i) + " number " + to_string(blk) + " out of range");
+          continue;
+        }
+        if(data_refs[blk]++ == 0)
+          data_blocks++;
+      }
+    }
+
+    // Formats sorted block numbers as ranges, e.g. "5-9 12"
+    static string ranges(const vector<int>& blocks) {
+      string out;
+      for(size_t i = 0; i < blocks.size(); ) {
+        size_t j = i;
+        while(j + 1 < blocks.size() && blocks[j + 1] == blocks[j] + 1)
+          j++;
+        out += (out.empty() ? "" : " ") + to_string(blocks[i]);
+        if(j > i)
+          out += "-" + to_string(blocks[j]);
+        i = j + 1;
+      }
+      return out;
+    }
+};
+
+static void usage() {
+  cerr << "Usage: ./nfsfsck [-r] [-j threads] DISK" << endl;
+  cerr << "  -r          write the rebuilt free bitmap back" << endl;
+  cerr << "  -j threads  threads verifying subtrees (default: number of CPUs)" << endl;
+  exit(2);
+}
+
+int main(int argc, char* argv[]) {
+  bool repair = false;
+  int num_threads = thread::hardware_concurrency();
+  int c;
+  while((c = getopt(argc, argv, "rj:")) != -1) {
+    switch(c) {
+      case 'r': repair = true; break;
+      case 'j': num_threads = atoi(optarg); break;
+      default: usage();
+    }
+  }
+  if(optind != argc - 1 || num_threads < 1)
+    usage();
+  const char* file_name = argv[optind];
+  if(access(file_name, R_OK | W_OK) == -1) {
+    perror(file_name);
+    return 2;
+  }
+
+  //Replay the journal so the home blocks are current
+  BasicFileSys bfs;
+  bfs.mount(file_name);
+  bfs.unmount();
+
+  //Load the file system blocks sequentially in large chunks
+  int fd = open(file_name, O_RDONLY);
+  if(fd == -1) {
+    perror(file_name);
+    return 2;
+  }
+  vector<datablock_t> image(NUM_BLOCKS);
+  for(int b = 0; b < NUM_BLOCKS; b += CHUNK_BLOCKS) {
+    size_t len = CHUNK_BLOCKS * BLOCK_SIZE;
+    if(pread(fd, &image[b], len, (off_t) b * BLOCK_SIZE) != (ssize_t) len) {
+      cerr << "Failed to read " << file_name << endl;
+      return 2;
+    }
+  }
+  close(fd);
+
+  //Checksums were stored, or computed for an older disk, by the mount
+  Disk disk;
+  disk.mount(file_name);
+  ChecksumTable checksums;
+  checksums.mount(&disk);
+
+  Checker checker(image);
+  checker.walk(num_threads);
+  superblock_t rebuilt;
+  checker.check_bitmap(rebuilt);
+  checker.check_checksums(checksums);
+  int problems = checker.report();
+
+  if(repair && memcmp(rebuilt.bitmap, image[0].data, BLOCK_SIZE) != 0) {
+    disk.write_block(0, (void*) &rebuilt);
+    checksums.update(0, (void*) &rebuilt);
+    checksums.flush();
+    disk.sync();
+    cout << "free bitmap rebuilt" << endl;
+  }
+  disk.unmount();
+  return problems ? 1 : 0;
+}
@@ -0,0 +1,331 @@
+// CPSC 3500: microbench
+// In-process microbenchmarks of the disk, basic file system and file system
+// layers, without the network. FileSys responses go to /dev/null instead of
+// a client socket.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+using namespace std;
+
+#include "Disk.h"
+#include "BasicFileSys.h"
+#include "FileSys.h"
+#include "Lease.h"
+#include "Blocks.h"
+
+typedef chrono::steady_clock bench_clock;
+
+// Nanoseconds since start
+static double ns_since(bench_clock::time_point start) {
+  return chrono::duration<double, nano>(bench_clock::now() - start).count();
+}
+
+// Times n calls of fn, returns the mean ns per call
+template<typename F>
+static double time_per_call(int n, F fn) {
+  bench_clock::time_point start = bench_clock::now();
+  for(int i = 0; i < n; i++)
+    fn(i);
+  return ns_since(start) / n;
+}
+
+// Opens a sink that stands in for a client socket
+static int open_sink() {
+  int fd = open("/dev/null", O_WRONLY);
+  if(fd == -1) {
+    perror("/dev/null");
+    exit(1);
+  }
+  return fd;
+}
+
+// Runs one operation as the server runs a request, answer sent and
+// scratch memory freed
+template<typename F>
+static void request(FileSys& fs, F op) {
+  op();
+  fs.send_deferred();
+}
+
+// Raw block reads and writes on the disk file
+static void bench_disk(const string& file_name, int rounds) {
+  Disk disk;
+  disk.mount(file_name.c_str());
+  datablock_t block;
+  memset(block.data, 'x', BLOCK_SIZE);
+  mt19937 rng(1);
+
+  int n = rounds * NUM_BLOCKS;
+  double seq_write = time_per_call(n, [&](int i) { disk.write_block(i % NUM_BLOCKS, &block); });
+  double seq_read = time_per_call(n, [&](int i) { disk.read_block(i % NUM_BLOCKS, &block); });
+  double rand_write = time_per_call(n, [&](int) { disk.write_block(rng() % NUM_BLOCKS, &block); });
+  double rand_read = time_per_call(n, [&](int) { disk.read_block(rng() % NUM_BLOCKS, &block); });
+  disk.unmount();
+
+  cout << "Disk block I/O (" << n << " blocks each)" << endl;
+  cout << left << setw(20) << "  op" << right << setw(12) << "ns/block" << setw(14) << "blocks/s"
+       << setw(10) << "MB/s" << endl;
+  const char* names[] = {"  sequential write", "  sequential read", "  random write", "  random read"};
+  double ns[] = {seq_write, seq_read, rand_write, rand_read};
+  for(int i = 0; i < 4; i++)
+    cout << left << setw(20) << names[i] << right << fixed << setprecision(0)
+         << setw(12) << ns[i] << setw(14) << 1e9 / ns[i]
+         << setw(10) << setprecision(1) << BLOCK_SIZE * 1e3 / ns[i] << endl;
+  cout << endl;
+}
+
+// Cost of get_free_block and reclaim_block as the disk fills up
+static void bench_alloc(BasicFileSys& bfs) {
+  const int BUCKETS = 10;
+  vector<short> blocks;
+  vector<double> alloc_ns(BUCKETS, 0), reclaim_ns(BUCKETS, 0);
+  vector<int> alloc_n(BUCKETS, 0), reclaim_n(BUCKETS, 0);
+
+  //Allocate until the disk is full, bucketed by how full it was
+  for(;;) {
+    int bucket = (blocks.size() + 2) * BUCKETS / NUM_BLOCKS;
+    bench_clock::time_point start = bench_clock::now();
+    short blk = bfs.get_free_block();
+    double ns = ns_since(start);
+    if(blk == 0)
+      break;
+    alloc_ns[bucket] += ns;
+    alloc_n[bucket]++;
+    blocks.push_back(blk);
+  }
+
+  //Reclaim them all again, from the front
+  for(size_t i = 0; i < blocks.size(); i++) {
+    int bucket = (blocks.size() - i + 1) * BUCKETS / NUM_BLOCKS;
+    bench_clock::time_point start = bench_clock::now();
+    bfs.reclaim_block(blocks[i]);
+    reclaim_ns[bucket] += ns_since(start);
+    reclaim_n[bucket]++;
+  }
+
+  //Reclaimed blocks are only free again once the operation commits
+  bfs.commit();
+
+  cout << "Block allocation vs disk fill (" << blocks.size() << " blocks)" << endl;
+  cout << left << setw(20) << "  disk used" << right << setw(18) << "get_free_block ns"
+       << setw(16) << "reclaim ns" << endl;
+  for(int b = 0; b < BUCKETS; b++) {
+    if(alloc_n[b] == 0 && reclaim_n[b] == 0)
+      continue;
+    string range = to_string(b * 100 / BUCKETS) + "-" + to_string((b + 1) * 100 / BUCKETS) + "%";
+    cout << "  " << left << setw(18) << range << right << fixed << setprecision(0)
+         << setw(18) << (alloc_n[b] ? alloc_ns[b] / alloc_n[b] : 0)
+         << setw(16) << (reclaim_n[b] ? reclaim_ns[b] / reclaim_n[b] : 0) << endl;
+  }
+  cout << endl;
+}
+
+// Directory lookup cost vs number of entries in the directory
+static void bench_dir(FileSys& fs, int rounds) {
+  cout << "Directory lookup vs entries (" << rounds << " lookups each)" << endl;
+  cout << left << setw(20) << "  entries" << right << setw(14) << "last ns"
+       << setw(14) << "missing ns" << endl;
+  request(fs, [&]() { fs.mkdir("dir"); });
+  request(fs, [&]() { fs.cd("dir"); });
+  for(int k = 1; k <= MAX_DIR_ENTRIES; k++) {
+    string name = "f" + to_string(k);
+    request(fs, [&]() { fs.create(name.c_str()); });
+    double last = time_per_call(rounds, [&](int) { request(fs, [&]() { fs.stat(name.c_str()); }); });
+    double missing = time_per_call(rounds, [&](int) { request(fs, [&]() { fs.stat("missing"); }); });
+    cout << "  " << left << setw(18) << k << right << fixed << setprecision(0)
+         << setw(14) << last << setw(14) << missing << endl;
+  }
+  for(int k = 1; k <= MAX_DIR_ENTRIES; k++)
+    request(fs, [&]() { fs.rm(("f" + to_string(k)).c_str()); });
+  request(fs, [&]() { fs.home(); });
+  request(fs, [&]() { fs.rmdir("dir"); });
+  cout << endl;
+}
+
+// Small reads and appends by name vs through an open handle, on the
+// last file of a full directory
+static void bench_handle(FileSys& fs, int rounds) {
+  cout << "Name vs handle, last file of a full directory (" << rounds << " calls each)" << endl;
+  cout << left << setw(20) << "  op" << right << setw(14) << "name ns"
+       << setw(14) << "handle ns" << endl;
+  request(fs, [&]() { fs.mkdir("dir"); });
+  request(fs, [&]() { fs.cd("dir"); });
+  for(int k = 1; k <= MAX_DIR_ENTRIES; k++)
+    request(fs, [&]() { fs.create(("f" + to_string(k)).c_str()); });
+  string last = "f" + to_string(MAX_DIR_ENTRIES);
+
+  //Past the inline size, so both go to the data blocks
+  string data(INLINE_SIZE + 1, 'x');
+  request(fs, [&]() { fs.append(last.c_str(), data.c_str()); });
+  request(fs, [&]() { fs.open(last.c_str()); }); //the session's first handle, 0
+
+  double head_ns = time_per_call(rounds, [&](int) { request(fs, [&]() { fs.head(last.c_str(), 64); }); });
+  double read_ns = time_per_call(rounds, [&](int) { request(fs, [&]() { fs.read(0, 64); }); });
+  double append_ns = time_per_call(rounds, [&](int) { request(fs, [&]() { fs.append(last.c_str(), "x"); }); });
+  double write_ns = time_per_call(rounds, [&](int) { request(fs, [&]() { fs.write(0, "x"); }); });
+  cout << "  " << left << setw(18) << "head / read" << right << fixed << setprecision(0)
+       << setw(14) << head_ns << setw(14) << read_ns << endl;
+  cout << "  " << left << setw(18) << "append / write" << right << fixed << setprecision(0)
+       << setw(14) << append_ns << setw(14) << write_ns << endl;
+
+  request(fs, [&]() { fs.close(0); });
+  for(int k = 1; k <= MAX_DIR_ENTRIES; k++)
+    request(fs, [&]() { fs.rm(("f" + to_string(k)).c_str()); });
+  request(fs, [&]() { fs.home(); });
+  request(fs, [&]() { fs.rmdir("dir"); });
+  cout << endl;
+}
+
+// Builds directory name in the cwd holding dirs directories of files
+// files of size bytes each
+static void make_tree(FileSys& fs, const char* name, int dirs, int files, unsigned int size) {
+  string data(size, 'x');
+  request(fs, [&]() { fs.mkdir(name); });
+  request(fs, [&]() { fs.cd(name); });
+  for(int d = 0; d < dirs; d++) {
+    string dir = "d" + to_string(d);
+    request(fs, [&]() { fs.mkdir(dir.c_str()); });
+    request(fs, [&]() { fs.cd(dir.c_str()); });
+    for(int f = 0; f < files; f++) {
+      string file = "f" + to_string(f);
+      request(fs, [&]() { fs.create(file.c_str()); });
+      request(fs, [&]() { fs.append(file.c_str(), data.c_str()); });
+    }
+    request(fs, [&]() { fs.home(); });
+    request(fs, [&]() { fs.cd(name); });
+  }
+  request(fs, [&]() { fs.home(); });
+}
+
+// Whole-subtree requests vs removing the subtree one entry at a time,
+// as a client without rm -r would
+static void bench_tree(FileSys& fs, int rounds) {
+  const int DIRS = 4, FILES = 5;
+  const unsigned int SIZE = 8 * BLOCK_SIZE;
+  cout << "Subtree of " << DIRS << " directories x " << FILES << " files of " << SIZE
+       << " bytes (" << rounds << " rounds)" << endl;
+  cout << left << setw(20) << "  op" << right << setw(14) << "us" << setw(14) << "requests" << endl;
+  double cp_ns = 0, du_ns = 0, rm_tree_ns = 0, rm_ns = 0;
+  for(int r = 0; r < rounds; r++) {
+    make_tree(fs, "tree", DIRS, FILES, SIZE);
+    bench_clock::time_point start = bench_clock::now();
+    request(fs, [&]() { fs.cp_tree("tree", "copy"); });
+    cp_ns += ns_since(start);
+    start = bench_clock::now();
+    request(fs, [&]() { fs.du("copy"); });
+    du_ns += ns_since(start);
+    start = bench_clock::now();
+    request(fs, [&]() { fs.rm_tree("copy"); });
+    rm_tree_ns += ns_since(start);
+
+    start = bench_clock::now();
+    request(fs, [&]() { fs.cd("tree"); });
+    for(int d = 0; d < DIRS; d++) {
+      string dir = "d" + to_string(d);
+      request(fs, [&]() { fs.cd(dir.c_str()); });
+      for(int f = 0; f < FILES; f++)
+        request(fs, [&]() { fs.rm(("f" + to_string(f)).c_str()); });
+      request(fs, [&]() { fs.home(); });
+      request(fs, [&]() { fs.cd("tree"); });
+      request(fs, [&]() { fs.rmdir(dir.c_str()); });
+    }
+    request(fs, [&]() { fs.home(); });
+    request(fs, [&]() { fs.rmdir("tree"); });
+    rm_ns += ns_since(start);
+  }
+  int rm_requests = 3 + DIRS * (FILES + 4);
+  cout << "  " << left << setw(18) << "cp -r" << right << fixed << setprecision(0)
+       << setw(14) << cp_ns / rounds / 1e3 << setw(14) << 1 << endl;
+  cout << "  " << left << setw(18) << "du" << right << fixed << setprecision(0)
+       << setw(14) << du_ns / rounds / 1e3 << setw(14) << 1 << endl;
+  cout << "  " << left << setw(18) << "rm -r" << right << fixed << setprecision(0)
+       << setw(14) << rm_tree_ns / rounds / 1e3 << setw(14) << 1 << endl;
+  cout << "  " << left << setw(18) << "rm + rmdir" << right << fixed << setprecision(0)
+       << setw(14) << rm_ns / rounds / 1e3 << setw(14) << rm_requests << endl;
+  cout << endl;
+}
+
+// Append and cat throughput, cp and rm time vs file size
+static void bench_file(FileSys& fs, int rounds) {
+  const unsigned int sizes[] = {INLINE_SIZE, BLOCK_SIZE, 8 * BLOCK_SIZE, 32 * BLOCK_SIZE, MAX_FILE_SIZE};
+  cout << "File append/cat vs size (" << rounds << " files each)" << endl;
+  cout << left << setw(20) << "  bytes" << right << setw(14) << "append MB/s"
+       << setw(14) << "cat MB/s" << setw(14) << "cp us" << setw(14) << "rm us" << endl;
+  for(unsigned int size : sizes) {
+    string data(size, 'x');
+    double append_ns = 0, cat_ns = 0, cp_ns = 0, rm_ns = 0;
+    for(int r = 0; r < rounds; r++) {
+      request(fs, [&]() { fs.create("file"); });
+      bench_clock::time_point start = bench_clock::now();
+      request(fs, [&]() { fs.append("file", data.c_str()); });
+      append_ns += ns_since(start);
+      start = bench_clock::now();
+      request(fs, [&]() { fs.cat("file"); });
+      cat_ns += ns_since(start);
+      start = bench_clock::now();
+      request(fs, [&]() { fs.cp("file", "copy"); });
+      cp_ns += ns_since(start);
+      start = bench_clock::now();
+      request(fs, [&]() { fs.rm("file"); });
+      rm_ns += ns_since(start);
+      request(fs, [&]() { fs.rm("copy"); });
+    }
+    cout << "  " << left << setw(18) << size << right << fixed << setprecision(1)
+         << setw(14) << size * 1e3 * rounds / append_ns
+         << setw(14) << size * 1e3 * rounds / cat_ns
+         << setw(14) << cp_ns / rounds / 1e3
+         << setw(14) << rm_ns / rounds / 1e3 << endl;
+  }
+  cout << endl;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = 20;
+  if(argc == 3 && strcmp(argv[1], "-n") == 0 && atoi(argv[2]) > 0) {
+    rounds = atoi(argv[2]);
+  } else if(argc != 1) {
+    cerr << "Usage: ./microbench [-n rounds]" << endl;
+    return 1;
+  }
+
+  char tmpl[] = "/tmp/microbench.XXXXXX";
+  if(!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  string dir = tmpl;
+  string raw_disk = dir + "/RAW";
+  string fs_disk = dir + "/DISK";
+
+  bench_disk(raw_disk, rounds);
+
+  BasicFileSys bfs;
+  bfs.mount(fs_disk.c_str());
+  bench_alloc(bfs);
+
+  LeaseTable lease_table;
+  LockTable locks;
+  DirCache dirs;
+  InodeTable inodes;
+  FileSys fs(bfs, lease_table, locks, dirs, inodes);
+  fs.mount(open_sink());
+  bench_dir(fs, rounds * 50);
+  bench_handle(fs, rounds * 50);
+  bench_file(fs, rounds * 5);
+  bench_tree(fs, rounds);
+  fs.unmount();
+  bfs.unmount();
+
+  unlink(raw_disk.c_str());
+  unlink(fs_disk.c_str());
+  rmdir(dir.c_str());
+  return 0;
+}
@@ -4,21 +4,70 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <signal.h>
+#include <thread>
+#include <mutex>
+#include <chrono>
 #include "FileSys.h"
+#include "Stats.h"
+#include "Trace.h"
 using namespace std;
 
 //Parses the command and executes it based on the command name
 void parse_exec(char* command, FileSys& fs);
 
+//Serves one client connection on its own thread until the client
+//closes the TCP connection
+void serve_client(int csock);
+
+//Writes the server statistics to stderr every time SIGUSR1 arrives
+void dump_stats();
+
+//Shared by all client sessions
+BasicFileSys bfs;        //basic file system on the mounted disk
+LeaseTable lease_table;  //read leases handed out to caching clients
+LockTable locks;         //directory and inode locks, sessions run concurrently
+DirCache dirs;           //directory versions, looked up without locks
+InodeTable inodes;       //files and directories in use, inodes of open files
+bool compress_files = false; //store the data of new files compressed
+bool dedup_blocks = false;   //share full data blocks with the same contents
+
 int main(int argc, char* argv[]) {
-	if (argc < 2) {
-		cout << "Usage: ./nfsserver port#\n";
+    //-d picks when operations count as durable, -z compresses new files,
+    //-u shares data blocks with the same contents
+    Durability durability = DURABILITY_PERIODIC;
+    bool usage = false;
+    int c;
+    while ((c = getopt(argc, argv, "d:zu")) != -1) {
+        switch (c) {
+            case 'd':
+                if (strcmp(optarg, "none") == 0)
+                    durability = DURABILITY_NONE;
+                else if (strcmp(optarg, "periodic") == 0)
+                    durability = DURABILITY_PERIODIC;
+                else if (strcmp(optarg, "request") == 0)
+                    durability = DURABILITY_REQUEST;
+                else
+                    usage = true;
+                break;
+            case 'z':
+                compress_files = true;
+                break;
+            case 'u':
+                dedup_blocks = true;
+                break;
+            default:
+                usage = true;
+        }
+    }
+	if (usage || argc != optind + 1) {
+		cout << "Usage: ./nfsserver [-d none|periodic|request] [-z] [-u] port#\n";
         return -1;
     }
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
 
     //networking part: create the socket and accept the client connection
     int ssock, csock;
@@ -38,114 +87,254 @@ int main(int argc, char* argv[]) {
         close(ssock);
         exit(1);
     }
-    if(listen(ssock, 1) == -1) {
+    if(listen(ssock, 16) == -1) {
         perror("listen");
         close(ssock);
         exit(1);
     }
-    FileSys fs;
-    bool err = false; //Error for clean exiting a socket fail
-    //Loop forever until Ctrl-C
-    while(!err) {
+
+    //a client that disconnects mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    //SIGUSR1 is only taken by the stats thread, every other thread
+    //inherits the blocked mask
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+    thread(dump_stats).detach();
+
+    //mount the disk once, every client session shares it
+    bfs.set_durability(durability);
+    bfs.mount();
+
+    //Loop forever until Ctrl-C, each client gets its own thread
+    while(true) {
         if((csock = accept(ssock, (sockaddr*) &cli_addr, &clilen)) == -1) {
             perror("accept");
-            close(ssock);
-            exit(1);
+            break;
         }
-        //mount the file system
-        fs.mount(csock);
-     
-        //loop: get the command from the client and invoke the file
-        //system operation which returns the results or error messages back to the clinet
-        //until the client closes the TCP connection.
-        bool get_cmd = true;
-        while(get_cmd) {
-            char buf[4096] = {0}; //Max bash line size
-            int msg_len = 4096;
-            int bytes_recv = 0;
-            char* p = (char*)buf;
-            while(bytes_recv < msg_len) {
-                int x = read(csock, (void*)buf, msg_len-bytes_recv);
-                //If error or client closed connection, listen for another connection
-                if(x == -1 || x == 0) {
+        //answers go out in one write each, Nagle would only hold back the
+        //last segment of a long one until the client's delayed ACK
+        int one = 1;
+        setsockopt(csock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        thread(serve_client, csock).detach();
+    }   
+    //close the listening socket
+    close(ssock);
+    bfs.unmount();
+
+    return 0;
+}
+
+//Serves one client connection on its own thread until the client
+//closes the TCP connection
+void serve_client(int csock) {
+    //mount the file system
+    FileSys fs(bfs, lease_table, locks, dirs, inodes);
+    fs.mount(csock);
+    fs.set_compression(compress_files);
+    fs.set_dedup(dedup_blocks);
+
+    //loop: get the command from the client and invoke the file
+    //system operation which returns the results or error messages back to the clinet
+    //until the client closes the TCP connection.
+    bool get_cmd = true;
+    while(get_cmd) {
+        char buf[4096] = {0}; //Max bash line size
+        int msg_len = 4096 - 1;
+        int bytes_recv = 0;
+        char* p = (char*)buf;
+        trace_clock::time_point recv_start;
+        while(bytes_recv < msg_len) {
+            int x = read(csock, (void*)p, msg_len-bytes_recv);
+            //If error or client closed connection, end the session
+            if(x == -1 || x == 0) {
+                if(x == -1)
                     perror("read");
-                    get_cmd = false;
-                    fs.unmount();
-                    break;
-                }
-                p += x;
-                bytes_recv += x;
-                //Stop reading command when \r\n is found
-                if(bytes_recv > 2 && *(p-2) == '\r' && *(p-1) == '\n')
-                    break;
-            }
-            //Parse and execute command
-            if(get_cmd) 
-                parse_exec(buf, fs);
-            //If read/write error stop the file system
-            if(fs.getError()) {
                 get_cmd = false;
-                err = true;
                 fs.unmount();
                 break;
             }
+            //The request starts when its first bytes arrive
+            if(bytes_recv == 0 && trace_on.load(memory_order_relaxed))
+                recv_start = trace_clock::now();
+            p += x;
+            bytes_recv += x;
+            //Stop reading command when \r\n is found
+            if(bytes_recv >= 2 && *(p-2) == '\r' && *(p-1) == '\n')
+                break;
         }
-    }   
-    //close the listening socket
-    close(ssock);
-
-    return 0;
+        //Parse and execute command
+        if(get_cmd) {
+            if(trace_on.load(memory_order_relaxed) && recv_start != trace_clock::time_point())
+                trace_event("recv", recv_start, bytes_recv);
+            Opcode op = opcode_of(buf);
+            request_counters = RequestCounters();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            {
+                TraceScope trace(opcode_name(op));
+                parse_exec(buf, fs);
+            }
+            //answers of mutating operations may wait for their group commit
+            //after the operation has let go of its locks
+            fs.send_deferred();
+            server_stats.record(op, request_counters, bytes_recv,
+                chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start));
+        }
+        //If read/write error stop the session
+        if(fs.getError()) {
+            get_cmd = false;
+            fs.unmount();
+        }
+    }
 }
 
 //Parses the command and executes it based on the command name
 void parse_exec(char* command, FileSys& fs) {
     //Parse cmd name
     char* tokens[3]; //3 potential fields
-    tokens[0] = strtok(command, " \r\n");
+    char* save; //strtok_r state, sessions parse on their own threads
+    tokens[0] = strtok_r(command, " \r\n", &save);
     
     //Check which command
     if(strcmp(tokens[0], "mkdir") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
         fs.mkdir(tokens[1]);
     }
     else if (strcmp(tokens[0], "cd") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
         fs.cd(tokens[1]);
     }
     else if (strcmp(tokens[0], "home") == 0) {
         fs.home();
     }
     else if (strcmp(tokens[0], "rmdir") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
         fs.rmdir(tokens[1]);
     }
     else if (strcmp(tokens[0], "ls") == 0) {
         fs.ls();
     }
     else if (strcmp(tokens[0], "create") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
         fs.create(tokens[1]);
     }
     else if (strcmp(tokens[0], "append") == 0) {
-        tokens[1] = strtok(NULL, " ");
-        tokens[2] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, " ", &save);
+        tokens[2] = strtok_r(NULL, "\r\n", &save);
         fs.append(tokens[1], tokens[2]);
     }
     else if (strcmp(tokens[0], "cat") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
         fs.cat(tokens[1]);
     }
     else if (strcmp(tokens[0], "head") == 0) {
-        tokens[1] = strtok(NULL, " ");
-        tokens[2] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, " ", &save);
+        tokens[2] = strtok_r(NULL, "\r\n", &save);
         fs.head(tokens[1], atoi(tokens[2]));
     }
     else if (strcmp(tokens[0], "rm") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
-        fs.rm(tokens[1]);
+        tokens[1] = strtok_r(NULL, " \r\n", &save);
+        if (tokens[1] && strcmp(tokens[1], "-r") == 0) {
+            tokens[2] = strtok_r(NULL, "\r\n", &save);
+            if (!tokens[2])
+                fs.missing_arg();
+            else
+                fs.rm_tree(tokens[2]);
+        }
+        else
+            fs.rm(tokens[1]);
     }
     else if (strcmp(tokens[0], "stat") == 0) {
-        tokens[1] = strtok(NULL, "\r\n");
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
         fs.stat(tokens[1]);
     }
+    else if (strcmp(tokens[0], "open") == 0) {
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
+        if (!tokens[1])
+            fs.missing_arg();
+        else
+            fs.open(tokens[1]);
+    }
+    else if (strcmp(tokens[0], "close") == 0) {
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
+        if (!tokens[1])
+            fs.missing_arg();
+        else
+            fs.close(atoi(tokens[1]));
+    }
+    else if (strcmp(tokens[0], "read") == 0) {
+        tokens[1] = strtok_r(NULL, " ", &save);
+        tokens[2] = strtok_r(NULL, "\r\n", &save);
+        if (!tokens[1] || !tokens[2])
+            fs.missing_arg();
+        else
+            fs.read(atoi(tokens[1]), atoi(tokens[2]));
+    }
+    else if (strcmp(tokens[0], "write") == 0) {
+        tokens[1] = strtok_r(NULL, " ", &save);
+        tokens[2] = strtok_r(NULL, "\r\n", &save);
+        if (!tokens[1] || !tokens[2])
+            fs.missing_arg();
+        else
+            fs.write(atoi(tokens[1]), tokens[2]);
+    }
+    else if (strcmp(tokens[0], "cp") == 0) {
+        tokens[1] = strtok_r(NULL, " \r\n", &save);
+        if (tokens[1] && strcmp(tokens[1], "-r") == 0) {
+            tokens[1] = strtok_r(NULL, " ", &save);
+            tokens[2] = strtok_r(NULL, "\r\n", &save);
+            if (!tokens[1] || !tokens[2])
+                fs.missing_arg();
+            else
+                fs.cp_tree(tokens[1], tokens[2]);
+        }
+        else {
+            tokens[2] = strtok_r(NULL, "\r\n", &save);
+            if (!tokens[1] || !tokens[2])
+                fs.missing_arg();
+            else
+                fs.cp(tokens[1], tokens[2]);
+        }
+    }
+    else if (strcmp(tokens[0], "mv") == 0) {
+        tokens[1] = strtok_r(NULL, " \r\n", &save);
+        tokens[2] = strtok_r(NULL, "\r\n", &save);
+        if (!tokens[1] || !tokens[2])
+            fs.missing_arg();
+        else
+            fs.mv(tokens[1], tokens[2]);
+    }
+    else if (strcmp(tokens[0], "du") == 0) {
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
+        fs.du(tokens[1]);
+    }
+    else if (strcmp(tokens[0], "snapshot") == 0) {
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
+        if (!tokens[1])
+            fs.missing_arg();
+        else
+            fs.snapshot(tokens[1]);
+    }
+    else if (strcmp(tokens[0], "lease") == 0) {
+        fs.lease();
+    }
+    else if (strcmp(tokens[0], "stats") == 0) {
+        fs.stats();
+    }
+    else if (strcmp(tokens[0], "trace") == 0) {
+        tokens[1] = strtok_r(NULL, "\r\n", &save);
+        fs.trace(tokens[1] ? tokens[1] : "dump");
+    }
+}
+
+//Writes the server statistics to stderr every time SIGUSR1 arrives
+void dump_stats() {
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    int sig;
+    while(sigwait(&usr1, &sig) == 0)
+        cerr << server_stats.report() << endl;
 }
\ No newline at end of file